@@ -0,0 +1,264 @@
+#include "Bitmap.h"
+#include "ufs.h"
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define BITMAP_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+Bitmap::Bitmap(bool nextFit) : address(0), numBits(0), blockSize(0), nextFit(nextFit), cursor(0)
+{
+    pthread_mutex_init(&this->lock, NULL);
+}
+
+Bitmap::~Bitmap()
+{
+    pthread_mutex_destroy(&this->lock);
+}
+
+void Bitmap::load(Disk* disk, int address, int length, int numBits)
+{
+    pthread_mutex_lock(&this->lock);
+    this->address = address;
+    this->numBits = numBits;
+    this->blockSize = UFS_BLOCK_SIZE;
+    this->dirty.clear();
+    this->cursor = 0;
+
+    // Read every block of the bitmap in a single request
+    vector<int> blocks(length);
+    for (int i = 0; i < length; i++) {
+        blocks[i] = address + i;
+    }
+    this->bytes.assign((size_t)length * this->blockSize, 0);
+    if (length > 0) {
+        disk->readBlocks(blocks.data(), length, this->bytes.data());
+    }
+    // Whole words, even if the super block claims more bits than blocks
+    size_t wordBytes = (size_t)(numBits + 63) / 64 * sizeof(uint64_t);
+    if (this->bytes.size() < wordBytes) {
+        this->bytes.resize(wordBytes, 0);
+    }
+    pthread_mutex_unlock(&this->lock);
+}
+
+// Remember what a bitmap block held before its first change since the
+// last flush. Callers hold the lock.
+void Bitmap::markDirty(int byteIndex)
+{
+    int block = byteIndex / this->blockSize;
+    if (this->dirty.count(block) == 0) {
+        vector<unsigned char>::iterator start = this->bytes.begin() + (size_t)block * this->blockSize;
+        this->dirty[block].assign(start, start + this->blockSize);
+    }
+}
+
+bool Bitmap::isSet(int bit)
+{
+    pthread_mutex_lock(&this->lock);
+    bool isSet = (this->bytes[bit / 8] & (1 << (bit % 8))) != 0;
+    pthread_mutex_unlock(&this->lock);
+    return isSet;
+}
+
+void Bitmap::set(int bit)
+{
+    pthread_mutex_lock(&this->lock);
+    markDirty(bit / 8);
+    this->bytes[bit / 8] |= (1 << (bit % 8));
+    pthread_mutex_unlock(&this->lock);
+}
+
+void Bitmap::clear(int bit)
+{
+    pthread_mutex_lock(&this->lock);
+    markDirty(bit / 8);
+    this->bytes[bit / 8] &= ~(1 << (bit % 8));
+    pthread_mutex_unlock(&this->lock);
+}
+
+// Bits at or past numBits in the last word read as set
+uint64_t Bitmap::word(size_t index)
+{
+    uint64_t bits;
+    memcpy(&bits, this->bytes.data() + index * sizeof(uint64_t), sizeof(bits));
+    size_t tail = this->numBits % 64;
+    if (tail != 0 && index == (size_t)(this->numBits - 1) / 64) {
+        bits |= ~0ULL << tail;
+    }
+    return bits;
+}
+
+#ifdef BITMAP_AVX2
+// Index of the first of words [index, last) that is not full, stepping
+// over 256 bits at a time and stopping short of the last word, which
+// word() pads. Built for AVX2 whatever -march says, so only call it
+// after checking the CPU has it.
+__attribute__((target("avx2")))
+static size_t skipFullWordsAvx2(const unsigned char* bytes, size_t index, size_t last)
+{
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    while (index + 4 < last) {
+        __m256i words = _mm256_loadu_si256((const __m256i*)(bytes + index * sizeof(uint64_t)));
+        if (!_mm256_testc_si256(words, ones)) {
+            break;
+        }
+        index += 4;
+    }
+    return index;
+}
+
+static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+// First clear bit in words [first, last), or -1. Runs of full words are
+// skipped 64 bits at a time, or 256 on CPUs with AVX2.
+int Bitmap::findClear(size_t first, size_t last)
+{
+    size_t index = first;
+#ifdef BITMAP_AVX2
+    // Next fit usually finds a clear bit in the first word; only long
+    // runs of full words are worth the vector loop
+    if (hasAvx2 && index < last && word(index) == ~0ULL) {
+        index = skipFullWordsAvx2(this->bytes.data(), index + 1, last);
+    }
+#endif
+    for (; index < last; index++) {
+        uint64_t bits = word(index);
+        if (bits != ~0ULL) {
+            return index * 64 + __builtin_ctzll(~bits);
+        }
+    }
+    return -1;
+}
+
+int Bitmap::allocate()
+{
+    pthread_mutex_lock(&this->lock);
+    size_t numWords = (size_t)(this->numBits + 63) / 64;
+    // Next fit starts where the last allocation was and wraps around
+    size_t start = this->nextFit && this->cursor < numWords ? this->cursor : 0;
+    int found = findClear(start, numWords);
+    if (found < 0 && start > 0) {
+        found = findClear(0, start);
+    }
+    if (found >= 0) {
+        markDirty(found / 8);
+        this->bytes[found / 8] |= (1 << (found % 8));
+        this->cursor = found / 64;
+    }
+    pthread_mutex_unlock(&this->lock);
+    return found;
+}
+
+// First bit of count clear bits in a row within bits [first, last), or
+// -1. Full and empty words are stepped over whole.
+int Bitmap::findClearRun(int first, int last, int count)
+{
+    int runStart = first;
+    int runLength = 0;
+    int bit = first;
+    while (bit < last) {
+        if (bit % 64 == 0 && bit + 64 <= last) {
+            uint64_t bits = word(bit / 64);
+            if (bits == ~0ULL) {
+                runLength = 0;
+                bit += 64;
+                continue;
+            }
+            if (bits == 0) {
+                if (runLength == 0) {
+                    runStart = bit;
+                }
+                runLength += 64;
+                if (runLength >= count) {
+                    return runStart;
+                }
+                bit += 64;
+                continue;
+            }
+        }
+        if (this->bytes[bit / 8] & (1 << (bit % 8))) {
+            runLength = 0;
+        } else {
+            if (runLength == 0) {
+                runStart = bit;
+            }
+            if (++runLength >= count) {
+                return runStart;
+            }
+        }
+        bit++;
+    }
+    return -1;
+}
+
+int Bitmap::allocateRun(int count)
+{
+    pthread_mutex_lock(&this->lock);
+    int start = this->nextFit ? min((size_t)this->numBits, this->cursor * 64) : 0;
+    int found = findClearRun(start, this->numBits, count);
+    if (found < 0 && start > 0) {
+        found = findClearRun(0, this->numBits, count);
+    }
+    if (found >= 0) {
+        for (int bit = found; bit < found + count; bit++) {
+            markDirty(bit / 8);
+            this->bytes[bit / 8] |= (1 << (bit % 8));
+        }
+        this->cursor = (found + count - 1) / 64;
+    }
+    pthread_mutex_unlock(&this->lock);
+    return found;
+}
+
+void Bitmap::copyTo(unsigned char* bits)
+{
+    pthread_mutex_lock(&this->lock);
+    memcpy(bits, this->bytes.data(), (this->numBits + 7) / 8);
+    pthread_mutex_unlock(&this->lock);
+}
+
+void Bitmap::copyFrom(const unsigned char* bits)
+{
+    pthread_mutex_lock(&this->lock);
+    size_t bitmapBytes = (this->numBits + 7) / 8;
+    for (size_t i = 0; i < bitmapBytes; i++) {
+        if (this->bytes[i] != bits[i]) {
+            markDirty(i);
+            this->bytes[i] = bits[i];
+        }
+    }
+    pthread_mutex_unlock(&this->lock);
+}
+
+void Bitmap::flush(Disk* disk)
+{
+    pthread_mutex_lock(&this->lock);
+    if (!this->dirty.empty()) {
+        vector<int> blocks;
+        vector<unsigned char> buffer;
+        for (map<int, vector<unsigned char> >::iterator iter = this->dirty.begin(); iter != this->dirty.end(); iter++) {
+            vector<unsigned char>::iterator start = this->bytes.begin() + (size_t)iter->first * this->blockSize;
+            blocks.push_back(this->address + iter->first);
+            buffer.insert(buffer.end(), start, start + this->blockSize);
+        }
+        disk->writeBlocks(blocks.data(), blocks.size(), buffer.data());
+        this->dirty.clear();
+    }
+    pthread_mutex_unlock(&this->lock);
+}
+
+void Bitmap::revert()
+{
+    pthread_mutex_lock(&this->lock);
+    for (map<int, vector<unsigned char> >::iterator iter = this->dirty.begin(); iter != this->dirty.end(); iter++) {
+        memcpy(this->bytes.data() + (size_t)iter->first * this->blockSize, iter->second.data(), this->blockSize);
+    }
+    this->dirty.clear();
+    pthread_mutex_unlock(&this->lock);
+}
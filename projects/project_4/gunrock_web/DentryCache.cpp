@@ -0,0 +1,142 @@
+#include <iomanip>
+#include <sstream>
+
+#include "DentryCache.h"
+
+using namespace std;
+
+DentryCache::DentryCache(LocalFileSystem *fileSystem, int capacity)
+    : fileSystem(fileSystem), capacity(capacity > 0 ? capacity : 1), generation(0),
+      hitCount(0), missCount(0), evictionCount(0) {
+  pthread_mutex_init(&this->lock, NULL);
+}
+
+DentryCache::~DentryCache() {
+  pthread_mutex_destroy(&this->lock);
+}
+
+int DentryCache::lookup(int parentInodeNumber, string name) {
+  Key key(parentInodeNumber, name);
+  pthread_mutex_lock(&this->lock);
+  map<Key, list<Entry>::iterator>::iterator found = this->entries.find(key);
+  if (found != this->entries.end()) {
+    this->lru.splice(this->lru.begin(), this->lru, found->second);
+    int inodeNumber = found->second->inodeNumber;
+    pthread_mutex_unlock(&this->lock);
+    this->hitCount.fetch_add(1, memory_order_relaxed);
+    return inodeNumber;
+  }
+  unsigned long generation = this->generation;
+  pthread_mutex_unlock(&this->lock);
+  this->missCount.fetch_add(1, memory_order_relaxed);
+
+  int inodeNumber = this->fileSystem->lookup(parentInodeNumber, name);
+  // Only a name that is there or definitely is not gets an entry
+  if (inodeNumber >= 0 || inodeNumber == -ENOTFOUND) {
+    pthread_mutex_lock(&this->lock);
+    if (this->generation == generation) {
+      insert(key, inodeNumber);
+    }
+    pthread_mutex_unlock(&this->lock);
+  }
+  return inodeNumber;
+}
+
+int DentryCache::create(int parentInodeNumber, int type, string name) {
+  int inodeNumber = this->fileSystem->create(parentInodeNumber, type, name);
+  if (inodeNumber >= 0) {
+    pthread_mutex_lock(&this->lock);
+    this->generation++;
+    insert(Key(parentInodeNumber, name), inodeNumber);
+    pthread_mutex_unlock(&this->lock);
+  }
+  return inodeNumber;
+}
+
+int DentryCache::unlink(int parentInodeNumber, string name) {
+  // The inode being removed may be reused, so whatever was cached under
+  // it (its "." and "..", negative entries) has to go with it
+  int inodeNumber = lookup(parentInodeNumber, name);
+  int rc = this->fileSystem->unlink(parentInodeNumber, name);
+  if (rc == 0) {
+    pthread_mutex_lock(&this->lock);
+    this->generation++;
+    if (inodeNumber >= 0) {
+      eraseChildren(inodeNumber);
+    }
+    insert(Key(parentInodeNumber, name), -ENOTFOUND);
+    pthread_mutex_unlock(&this->lock);
+  }
+  return rc;
+}
+
+// Add or replace an entry, evicting the least recently used one if the
+// cache is full. Callers hold the lock.
+void DentryCache::insert(const Key &key, int inodeNumber) {
+  erase(key);
+  Entry entry;
+  entry.key = key;
+  entry.inodeNumber = inodeNumber;
+  this->lru.push_front(entry);
+  this->entries[key] = this->lru.begin();
+
+  while (this->entries.size() > this->capacity) {
+    this->entries.erase(this->lru.back().key);
+    this->lru.pop_back();
+    this->evictionCount.fetch_add(1, memory_order_relaxed);
+  }
+}
+
+void DentryCache::erase(const Key &key) {
+  map<Key, list<Entry>::iterator>::iterator found = this->entries.find(key);
+  if (found != this->entries.end()) {
+    this->lru.erase(found->second);
+    this->entries.erase(found);
+  }
+}
+
+// Entries are ordered by parent first, so a directory's are contiguous
+void DentryCache::eraseChildren(int parentInodeNumber) {
+  map<Key, list<Entry>::iterator>::iterator iter = this->entries.lower_bound(Key(parentInodeNumber, ""));
+  while (iter != this->entries.end() && iter->first.first == parentInodeNumber) {
+    this->lru.erase(iter->second);
+    this->entries.erase(iter++);
+  }
+}
+
+void DentryCache::recordResolution(unsigned long usec) {
+  this->resolutionLatency.record(usec);
+}
+
+unsigned long DentryCache::hits() {
+  return this->hitCount.load(memory_order_relaxed);
+}
+
+unsigned long DentryCache::misses() {
+  return this->missCount.load(memory_order_relaxed);
+}
+
+unsigned long DentryCache::evictions() {
+  return this->evictionCount.load(memory_order_relaxed);
+}
+
+int DentryCache::size() {
+  pthread_mutex_lock(&this->lock);
+  int entries = this->entries.size();
+  pthread_mutex_unlock(&this->lock);
+  return entries;
+}
+
+string DentryCache::statsReport() {
+  stringstream out;
+  unsigned long hits = this->hits();
+  unsigned long lookups = hits + this->misses();
+  out << "dentry cache     " << hits << " hits, " << this->misses() << " misses, "
+      << this->evictions() << " evictions, " << this->size() << "/" << this->capacity << " entries";
+  if (lookups > 0) {
+    out << " (" << fixed << setprecision(1) << 100.0 * hits / lookups << "% hit rate)";
+  }
+  out << endl;
+  out << "path resolution     " << this->resolutionLatency.report("  ");
+  return out.str();
+}
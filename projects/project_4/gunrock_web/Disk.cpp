@@ -1,142 +1,97 @@
+#include <cstring>
 #include <iostream>
-#include <unistd.h>
-
-#include <fcntl.h>
-#include <stdlib.h>
-
-#include <sys/types.h>
-#include <sys/uio.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
+#include <sstream>
+#include <vector>
 
 #include "Disk.h"
-#include "dthread.h"
+#include "FileDisk.h"
+#include "RamDisk.h"
+#include "SnapshotDisk.h"
+#include "StripedDisk.h"
 
 using namespace std;
 
-Disk::Disk(string imageFile, int blockSize) {
-  this->imageFile = imageFile;
-  this->blockSize = blockSize;
-  this->isInTransaction = false;
-  
-  struct stat stat;
-  int imageFileDescriptor = open(imageFile.c_str(), O_RDONLY);
-  if (imageFileDescriptor < 0) {
-    cerr << "could not open " << imageFile << endl;
-    exit(1);
+#define RAM_PREFIX "ram:"
+#define RAMDUMP_PREFIX "ramdump:"
+#define STRIPE_PREFIX "stripe:"
+#define COW_PREFIX "cow:"
+
+Disk *Disk::open(string imageFile, int blockSize) {
+  if (imageFile.compare(0, strlen(RAM_PREFIX), RAM_PREFIX) == 0) {
+    return new RamDisk(imageFile.substr(strlen(RAM_PREFIX)), blockSize, false);
   }
-  int ret = fstat(imageFileDescriptor, &stat);
-  if (ret != 0) {
-    cerr << "Could not stat image file" << endl;
-    exit(1);
+  if (imageFile.compare(0, strlen(RAMDUMP_PREFIX), RAMDUMP_PREFIX) == 0) {
+    return new RamDisk(imageFile.substr(strlen(RAMDUMP_PREFIX)), blockSize, true);
   }
-  close(imageFileDescriptor);
-  
-  this->imageFileSize = stat.st_size;
-
-  if ((this->imageFileSize % this->blockSize) != 0 || this->blockSize == 0) {
-    cerr << "Your disk image size must be a multiple of your block size" << endl;
-    cerr << "  imageSize: " << this->imageFileSize << endl;
-    cerr << "  blockSize: " << this->blockSize << endl;
-    cerr << "  imageSize % blockSize: " << this->imageFileSize % this->blockSize << endl;
-    exit(1);
+  if (imageFile.compare(0, strlen(STRIPE_PREFIX), STRIPE_PREFIX) == 0) {
+    vector<string> members;
+    string list = imageFile.substr(strlen(STRIPE_PREFIX));
+    size_t start = 0;
+    size_t comma;
+    while ((comma = list.find(',', start)) != string::npos) {
+      members.push_back(list.substr(start, comma - start));
+      start = comma + 1;
+    }
+    members.push_back(list.substr(start));
+    return new StripedDisk(members, blockSize);
+  }
+  if (imageFile.compare(0, strlen(COW_PREFIX), COW_PREFIX) == 0) {
+    return new SnapshotDisk(imageFile.substr(strlen(COW_PREFIX)), blockSize);
   }
-  
+  return new FileDisk(imageFile, blockSize);
 }
 
-int Disk::numberOfBlocks() {
-  return this->imageFileSize / this->blockSize;
+Disk::~Disk() {
 }
 
 void Disk::readBlock(int blockNumber, void *buffer) {
-  if (blockNumber < 0 || blockNumber >= this->numberOfBlocks()) {
-    cerr << "Invalid block number " << blockNumber << endl;
-    exit(1);
-  }
-
-  int fd = open(this->imageFile.c_str(), O_RDONLY);
-  if (fd < 0) {
-    cerr << "Could not open image file " << this->imageFile << endl;
-    exit(1);
-  }
-
-  int offset = blockNumber * this->blockSize;
-  int ret = lseek(fd, offset, SEEK_SET);
-  if (ret != offset) {
-    perror("read::lseek");
-    cerr << "Could not seek to file" << endl;
-    exit(1);
-  }
+  readBlocks(&blockNumber, 1, buffer);
+}
 
-  ret = read(fd, buffer, this->blockSize);
-  if (ret != this->blockSize) {
-    cerr << "Could not read file" << endl;
-    exit(1);
-  }
+void Disk::writeBlock(int blockNumber, void *buffer) {
+  writeBlocks(&blockNumber, 1, buffer);
+}
 
-  close(fd);
+unsigned long Disk::syscallCount() {
+  return 0;
 }
 
-void Disk::writeBlock(int blockNumber, void *buffer) {  
-  if (blockNumber < 0 || blockNumber >= this->numberOfBlocks()) {
-    cerr << "Invalid block number " << blockNumber << endl;
-    exit(1);
-  }
+const DiskStats& Disk::stats() {
+  return this->diskStats;
+}
 
-  if (isInTransaction) {
-    struct UndoRecord undoRecord;
-    undoRecord.blockNumber = blockNumber;
-    undoRecord.blockData = new unsigned char[blockSize];
-    this->readBlock(blockNumber, undoRecord.blockData);
-    undoLog.push_front(undoRecord);
-  }
-  
-  int fd = open(this->imageFile.c_str(), O_RDWR);
-  if (fd < 0) {
-    cerr << "Could not open image file " << this->imageFile << endl;
-    exit(1);
-  }
+string Disk::statsReport() {
+  stringstream out;
+  out << "blocks read      " << diskStats.blocksRead << " (" << diskStats.bytesRead << " bytes)" << endl;
+  out << "blocks written   " << diskStats.blocksWritten << " (" << diskStats.bytesWritten << " bytes)" << endl;
+  out << "blocks discarded " << diskStats.discards << endl;
+  out << "syncs            " << diskStats.syncs << endl;
+  out << "journal records  " << diskStats.journalRecords << " (" << diskStats.checkpoints << " checkpoints)" << endl;
+  out << "transactions     " << diskStats.commits << " committed, " << diskStats.rollbacks << " rolled back" << endl;
+  out << "system calls     " << syscallCount() << endl;
+  out << "block cache      " << cacheHits() << " hits, " << cacheMisses() << " misses, "
+      << cacheEvictions() << " evictions" << endl;
+  out << "read latency        " << diskStats.readLatency.report("  ");
+  out << "write latency       " << diskStats.writeLatency.report("  ");
+  out << "sync latency        " << diskStats.syncLatency.report("  ");
+  out << "transaction latency " << diskStats.transactionLatency.report("  ");
+  return out.str();
+}
 
-  int offset = blockNumber * this->blockSize;
-  int ret = lseek(fd, offset, SEEK_SET);
-  if (ret != offset) {
-    perror("write::lseek");
-    cerr << "Could not seek to file" << endl;
-    exit(1);
-  }
+void Disk::setGroupCommitWindow(int usec) {
+}
 
-  ret = write(fd, buffer, this->blockSize);
-  if (ret != this->blockSize) {
-    cerr << "Could not write file" << endl;
-    exit(1);
-  }
-  fsync(fd);
-  close(fd);
+void Disk::setCacheCapacity(int blocks) {
 }
 
-void Disk::beginTransaction() {
-  if (isInTransaction) {
-    cerr << "You can't start a new transaction: one already exists" << endl;
-    exit(1);
-  }
-  isInTransaction = true;
+unsigned long Disk::cacheHits() {
+  return 0;
 }
 
-void Disk::commit() {
-  isInTransaction = false;
-  deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    delete [] iter->blockData;
-  }
-  undoLog.clear();
+unsigned long Disk::cacheMisses() {
+  return 0;
 }
 
-void Disk::rollback() {
-  isInTransaction = false;
-  deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    this->writeBlock(iter->blockNumber, iter->blockData);
-    delete [] iter->blockData;
-  }
-  undoLog.clear();
+unsigned long Disk::cacheEvictions() {
+  return 0;
 }
@@ -0,0 +1,83 @@
+#include <sstream>
+
+#include "DiskStats.h"
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram() : samples(0), total(0) {
+  for (int i = 0; i < DISK_LATENCY_BUCKETS; i++) {
+    buckets[i] = 0;
+  }
+}
+
+void LatencyHistogram::record(unsigned long usec) {
+  int index = 0;
+  for (unsigned long rest = usec; rest > 0 && index < DISK_LATENCY_BUCKETS - 1; rest >>= 1) {
+    index++;
+  }
+  this->buckets[index].fetch_add(1, memory_order_relaxed);
+  this->samples.fetch_add(1, memory_order_relaxed);
+  this->total.fetch_add(usec, memory_order_relaxed);
+}
+
+unsigned long LatencyHistogram::count() const {
+  return this->samples.load(memory_order_relaxed);
+}
+
+unsigned long LatencyHistogram::totalUsec() const {
+  return this->total.load(memory_order_relaxed);
+}
+
+unsigned long LatencyHistogram::bucket(int index) const {
+  return this->buckets[index].load(memory_order_relaxed);
+}
+
+unsigned long LatencyHistogram::percentile(double fraction) const {
+  unsigned long counts[DISK_LATENCY_BUCKETS];
+  unsigned long all = 0;
+  for (int i = 0; i < DISK_LATENCY_BUCKETS; i++) {
+    counts[i] = bucket(i);
+    all += counts[i];
+  }
+
+  unsigned long seen = 0;
+  for (int i = 0; i < DISK_LATENCY_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen > 0 && seen >= fraction * all) {
+      return 1UL << i;
+    }
+  }
+  return 0;
+}
+
+string LatencyHistogram::report(string indent) const {
+  stringstream out;
+  unsigned long n = count();
+  out << "count " << n;
+  if (n > 0) {
+    out << " avg " << totalUsec() / n << "us"
+        << " p50 <" << percentile(0.5) << "us"
+        << " p99 <" << percentile(0.99) << "us";
+  }
+  out << endl;
+
+  for (int i = 0; i < DISK_LATENCY_BUCKETS; i++) {
+    unsigned long samplesInBucket = bucket(i);
+    if (samplesInBucket == 0) {
+      continue;
+    }
+    out << indent;
+    if (i == DISK_LATENCY_BUCKETS - 1) {
+      out << ">=" << (1UL << (i - 1)) << "us";
+    } else {
+      out << "<" << (1UL << i) << "us";
+    }
+    out << " " << samplesInBucket << endl;
+  }
+  return out.str();
+}
+
+DiskStats::DiskStats()
+    : blocksRead(0), bytesRead(0), blocksWritten(0), bytesWritten(0), syncs(0),
+      discards(0), journalRecords(0), checkpoints(0), commits(0), rollbacks(0) {
+}
@@ -0,0 +1,23 @@
+#include <string>
+
+#include "DiskStatsService.h"
+#include "ClientError.h"
+
+using namespace std;
+
+DiskStatsService::DiskStatsService(Disk *disk, DentryCache *dentries) : HttpService("/admin/disk") {
+  this->disk = disk;
+  this->dentries = dentries;
+}
+
+void DiskStatsService::get(HTTPRequest *request, HTTPResponse *response) {
+  if (request->getPath() != pathPrefix()) {
+    throw ClientError::notFound();
+  }
+  response->setContentType("text/plain");
+  string report = this->disk->statsReport();
+  if (this->dentries != NULL) {
+    report += this->dentries->statsReport();
+  }
+  response->setBody(report);
+}
@@ -1,15 +1,19 @@
 #include <algorithm>
+#include <cstring>
 #include <fcntl.h>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <time.h>
 #include <unistd.h>
 #include <vector>
 
 #include "ClientError.h"
+#include "DentryCache.h"
 #include "DistributedFileSystemService.h"
 #include "WwwFormEncodedDict.h"
 #include "ufs.h"
@@ -37,24 +41,37 @@ int formatDirectoryEntries(LocalFileSystem* const fs, const vector<dir_ent_t>& e
 int handleFileContent(LocalFileSystem* const fs, vector<string>& pathComponents, stringstream& output, const size_t targetInodeSize, const size_t targetInodeNumber);
 int handleDirectoryContent(LocalFileSystem* const fs, const inode_t& targetInode, const size_t targetInodeNumber, stringstream& output);
 
-// Main filesystem operations
-int navigateToDirectory(LocalFileSystem* const fs, const vector<string>& pathComponents, size_t& targetInode);
-int getPathContents(LocalFileSystem* const fs, vector<string>& pathComponents, stringstream& output);
-int ensurePathExists(LocalFileSystem* const fs, const vector<string>& pathComponents, size_t& targetInode);
-int createOrUpdateFile(LocalFileSystem* const fs, const vector<string>& pathComponents, const string& fileContent);
-int deleteEntry(LocalFileSystem* const fs, vector<string>& pathComponents);
+// Main filesystem operations; names are resolved through the dentry cache
+int navigateToDirectory(DentryCache* const dentries, const vector<string>& pathComponents, size_t& targetInode);
+int getPathContents(LocalFileSystem* const fs, DentryCache* const dentries, vector<string>& pathComponents, stringstream& output);
+int ensurePathExists(DentryCache* const dentries, const vector<string>& pathComponents, size_t& targetInode);
+int createOrUpdateFile(LocalFileSystem* const fs, DentryCache* const dentries, const vector<string>& pathComponents, const string& fileContent);
+int deleteEntry(DentryCache* const dentries, vector<string>& pathComponents);
 
-DistributedFileSystemService::DistributedFileSystemService(string diskFile)
+static unsigned long nowUsec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+DistributedFileSystemService::DistributedFileSystemService(Disk* disk)
     : HttpService("/ds3/")
 {
-    this->fileSystem = new LocalFileSystem(new Disk(diskFile, UFS_BLOCK_SIZE));
+    this->fileSystem = new LocalFileSystem(disk);
+    this->dentryCache = new DentryCache(this->fileSystem);
+}
+
+DentryCache* DistributedFileSystemService::dentries()
+{
+    return this->dentryCache;
 }
 
 void DistributedFileSystemService::get(HTTPRequest* request, HTTPResponse* response)
 {
     vector<string> pathComponents = request->getPathComponents();
     stringstream stringStream;
-    int rc = getPathContents(this->fileSystem, pathComponents, stringStream);
+    int rc = getPathContents(this->fileSystem, this->dentryCache, pathComponents, stringStream);
     sendResponse(response, rc, stringStream.str());
 }
 
@@ -62,14 +79,14 @@ void DistributedFileSystemService::put(HTTPRequest* request, HTTPResponse* respo
 {
     vector<string> pathComponents = request->getPathComponents();
     string fileContent = request->getBody();
-    int rc = createOrUpdateFile(this->fileSystem, pathComponents, fileContent);
+    int rc = createOrUpdateFile(this->fileSystem, this->dentryCache, pathComponents, fileContent);
     sendResponse(response, rc, "File Successfully updated\n");
 }
 
 void DistributedFileSystemService::del(HTTPRequest* request, HTTPResponse* response)
 {
     vector<string> pathComponents = request->getPathComponents();
-    int rc = deleteEntry(this->fileSystem, pathComponents);
+    int rc = deleteEntry(this->dentryCache, pathComponents);
     sendResponse(response, rc, "Entry has been deleted\n");
 }
 
@@ -141,15 +158,23 @@ int formatDirectoryEntries(LocalFileSystem* const fs, const vector<dir_ent_t>& e
     if (entries.empty()) {
         return SUCCESS;
     }
+
+    // Stat every entry at once, so each inode block is read at most once
+    vector<int> inodeNumbers;
+    for (size_t i = 0; i < entries.size(); i++) {
+        inodeNumbers.push_back(entries.at(i).inum);
+    }
+    vector<inode_t> inodes(entries.size());
+    int rc = fs->statMany(inodeNumbers.data(), inodeNumbers.size(), inodes.data());
+    if (rc < 0) {
+        return rc;
+    }
+
     for (size_t i = 0; i < entries.size(); i++) {
         if (strcmp(entries.at(i).name, ".") == 0 || strcmp(entries.at(i).name, "..") == 0) { // skip .. and . entries
             continue;
         }
-        inode_t inode;
-        int rc = fs->stat(entries.at(i).inum, &inode);
-        if (rc < 0) {
-            return rc;
-        }
+        const inode_t& inode = inodes.at(i);
         if (inode.type == UFS_DIRECTORY) {
             stringStream << entries[i].name << "/" << endl;
             continue;
@@ -181,7 +206,7 @@ int handleDirectoryContent(LocalFileSystem* const fs, const inode_t& targetInode
     return SUCCESS;
 }
 
-int navigateToDirectory(LocalFileSystem* const fs, const vector<string>& pathComponents, size_t& targetInode)
+int navigateToDirectory(DentryCache* const dentries, const vector<string>& pathComponents, size_t& targetInode)
 {
     // Validate input (paths)
     int validationResult = validatePathComponents(pathComponents, targetInode);
@@ -190,15 +215,18 @@ int navigateToDirectory(LocalFileSystem* const fs, const vector<string>& pathCom
     }
 
     // Navigate through path (start after ds3)
+    unsigned long began = nowUsec();
     size_t currentInode = 0;
     for (size_t i = 1; i < pathComponents.size(); i++) {
-        int nextInode = fs->lookup(currentInode, pathComponents[i]);
+        int nextInode = dentries->lookup(currentInode, pathComponents[i]);
         if (nextInode == -EINVALIDINODE || nextInode == -ENOTFOUND) {
+            dentries->recordResolution(nowUsec() - began);
             return NOT_FOUND;
         }
         currentInode = nextInode;
     }
     targetInode = currentInode;
+    dentries->recordResolution(nowUsec() - began);
 
     return SUCCESS;
 }
@@ -211,7 +239,7 @@ int validateName(string fileName)
     return SUCCESS;
 }
 
-int ensurePathExists(LocalFileSystem* const fs, const vector<string>& pathComponents, size_t& targetInode)
+int ensurePathExists(DentryCache* const dentries, const vector<string>& pathComponents, size_t& targetInode)
 {
     // Validate path first
     int validationResult = validatePathComponents(pathComponents, targetInode);
@@ -220,18 +248,21 @@ int ensurePathExists(LocalFileSystem* const fs, const vector<string>& pathCompon
     }
 
     // Navigate through path (start after ds3)
+    unsigned long began = nowUsec();
     size_t currentInode = 0;
     bool restOfPathExists = true;
     ssize_t nextInode = 0;
+    int rc = SUCCESS;
     for (size_t i = 1; i < pathComponents.size(); i++) {
         const string& component = pathComponents.at(i);
         if (validateName(component) != SUCCESS) {
-            return BAD_REQUEST;
+            rc = BAD_REQUEST;
+            break;
         }
 
         // look up next inode
         if (restOfPathExists) {
-            nextInode = fs->lookup(currentInode, component);
+            nextInode = dentries->lookup(currentInode, component);
         }
 
         // create next inode (file or directory)
@@ -239,21 +270,27 @@ int ensurePathExists(LocalFileSystem* const fs, const vector<string>& pathCompon
             restOfPathExists = false;
             bool isLastComponent = (i == pathComponents.size() - 1);
             int newInodeType = isLastComponent ? UFS_REGULAR_FILE : UFS_DIRECTORY;
-            int newInodeNum = fs->create(currentInode, newInodeType, component);
+            int newInodeNum = dentries->create(currentInode, newInodeType, component);
             if (newInodeNum < 0) {
-                return BAD_REQUEST;
+                rc = BAD_REQUEST;
+                break;
             }
             currentInode = newInodeNum;
             continue;
         }
         currentInode = nextInode;
     }
+    // Failed resolutions are timed too
+    dentries->recordResolution(nowUsec() - began);
+    if (rc != SUCCESS) {
+        return rc;
+    }
     targetInode = currentInode;
 
     return SUCCESS;
 }
 
-int deleteEntry(LocalFileSystem* const fs, vector<string>& pathComponents)
+int deleteEntry(DentryCache* const dentries, vector<string>& pathComponents)
 {
     if (pathComponents.size() > 1) {
         string entryNameToDelete = pathComponents.back();
@@ -267,13 +304,13 @@ int deleteEntry(LocalFileSystem* const fs, vector<string>& pathComponents)
 
         // grab inode number of parent directory
         size_t parentDirInodeNum;
-        rc = navigateToDirectory(fs, pathComponents, parentDirInodeNum);
+        rc = navigateToDirectory(dentries, pathComponents, parentDirInodeNum);
         if (rc != SUCCESS) {
             return rc;
         }
 
         // delete entry
-        rc = fs->unlink(parentDirInodeNum, entryNameToDelete);
+        rc = dentries->unlink(parentDirInodeNum, entryNameToDelete);
         if (rc == -ENOTFOUND) {
             return NOT_FOUND;
         }
@@ -286,11 +323,11 @@ int deleteEntry(LocalFileSystem* const fs, vector<string>& pathComponents)
     return SUCCESS;
 }
 
-int createOrUpdateFile(LocalFileSystem* const fs, const vector<string>& pathComponents, const string& fileContent)
+int createOrUpdateFile(LocalFileSystem* const fs, DentryCache* const dentries, const vector<string>& pathComponents, const string& fileContent)
 {
     // Ensure path exists and get target inode number
     size_t targetInodeNumber;
-    int rc = ensurePathExists(fs, pathComponents, targetInodeNumber);
+    int rc = ensurePathExists(dentries, pathComponents, targetInodeNumber);
     if (rc != SUCCESS) {
         return rc;
     }
@@ -318,11 +355,11 @@ int createOrUpdateFile(LocalFileSystem* const fs, const vector<string>& pathComp
     return SUCCESS;
 }
 
-int getPathContents(LocalFileSystem* const fs, vector<string>& pathComponents, stringstream& output)
+int getPathContents(LocalFileSystem* const fs, DentryCache* const dentries, vector<string>& pathComponents, stringstream& output)
 {
     // Navigate to target directory and get inode number
     size_t targetInodeNumber;
-    int navResult = navigateToDirectory(fs, pathComponents, targetInodeNumber);
+    int navResult = navigateToDirectory(dentries, pathComponents, targetInodeNumber);
     if (navResult != SUCCESS) {
         return navResult;
     }
@@ -0,0 +1,1033 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "FileDisk.h"
+#include "dthread.h"
+#include "ufs.h"
+
+using namespace std;
+
+#define MMAP_PREFIX "mmap:"
+#define URING_PREFIX "uring:"
+#define DIRECT_PREFIX "direct:"
+
+// O_DIRECT buffers and offsets must be aligned to the device block size
+#define DISK_DIRECT_ALIGNMENT (4096)
+
+// Most iovecs handed to a single preadv/pwritev
+#define DISK_MAX_IOVECS (256)
+
+// Monotonic time in microseconds, for the latency histograms
+static unsigned long nowUsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// FNV-1a, used to detect torn journal records
+static unsigned int journalChecksum(const unsigned char *data, size_t length) {
+  unsigned int hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+FileDisk::FileDisk(string imageFile, int blockSize) {
+  this->mode = DISK_MODE_FILE;
+  if (imageFile.compare(0, strlen(MMAP_PREFIX), MMAP_PREFIX) == 0) {
+    this->mode = DISK_MODE_MMAP;
+    imageFile = imageFile.substr(strlen(MMAP_PREFIX));
+  } else if (imageFile.compare(0, strlen(URING_PREFIX), URING_PREFIX) == 0) {
+    this->mode = DISK_MODE_URING;
+    imageFile = imageFile.substr(strlen(URING_PREFIX));
+  } else if (imageFile.compare(0, strlen(DIRECT_PREFIX), DIRECT_PREFIX) == 0) {
+    this->mode = DISK_MODE_DIRECT;
+    imageFile = imageFile.substr(strlen(DIRECT_PREFIX));
+  }
+
+  this->imageFile = imageFile;
+  this->blockSize = blockSize;
+  this->isInTransaction = false;
+  this->syscalls = 0;
+  this->transactionStartUsec = 0;
+  this->readOnly = false;
+  this->mapping = NULL;
+  this->ring = NULL;
+  this->groupCommitWindowUsec = 0;
+  this->syncRequested = 0;
+  this->syncCompleted = 0;
+  this->syncing = false;
+  this->journalStart = 0;
+  this->journalLen = 0;
+  this->journalHead = 0;
+  this->journalSeq = 0;
+  this->cacheCapacity = DISK_DEFAULT_CACHE_BLOCKS;
+  this->hits = 0;
+  this->misses = 0;
+  this->evictions = 0;
+  this->generation = 0;
+  pthread_mutex_init(&this->cacheLock, NULL);
+  pthread_mutex_init(&this->transactionLock, NULL);
+  pthread_mutex_init(&this->syncLock, NULL);
+  pthread_cond_init(&this->syncCond, NULL);
+  pthread_mutex_init(&this->journalLock, NULL);
+  pthread_mutex_init(&this->poolLock, NULL);
+
+  // Keep one descriptor open for the life of the Disk so that block I/O
+  // is a single pread/pwrite instead of open/lseek/read/close per block.
+  // Images that we are not allowed to write to are still readable.
+  int flags = this->mode == DISK_MODE_DIRECT ? O_DIRECT : 0;
+  this->fd = ::open(imageFile.c_str(), O_RDWR | flags);
+  if (this->fd < 0 && (errno == EACCES || errno == EROFS)) {
+    this->fd = ::open(imageFile.c_str(), O_RDONLY | flags);
+    this->readOnly = true;
+  }
+  if (this->fd < 0 && errno == EINVAL && this->mode == DISK_MODE_DIRECT) {
+    cerr << "could not open " << imageFile << ": O_DIRECT is not supported by its file system" << endl;
+    exit(1);
+  }
+  if (this->fd < 0) {
+    cerr << "could not open " << imageFile << endl;
+    exit(1);
+  }
+
+  struct stat stat;
+  int ret = fstat(this->fd, &stat);
+  if (ret != 0) {
+    cerr << "Could not stat image file" << endl;
+    exit(1);
+  }
+
+  this->imageFileSize = stat.st_size;
+
+  if ((this->imageFileSize % this->blockSize) != 0 || this->blockSize == 0) {
+    cerr << "Your disk image size must be a multiple of your block size" << endl;
+    cerr << "  imageSize: " << this->imageFileSize << endl;
+    cerr << "  blockSize: " << this->blockSize << endl;
+    cerr << "  imageSize % blockSize: " << this->imageFileSize % this->blockSize << endl;
+    exit(1);
+  }
+  this->totalBlocks = this->imageFileSize / this->blockSize;
+
+  if (this->mode == DISK_MODE_MMAP) {
+    int protection = this->readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+    void *addr = mmap(NULL, this->imageFileSize, protection, MAP_SHARED, this->fd, 0);
+    if (addr == MAP_FAILED) {
+      perror("mmap");
+      cerr << "Could not map image file " << imageFile << endl;
+      exit(1);
+    }
+    this->mapping = (unsigned char *) addr;
+    // the mapping already serves reads from memory
+    this->cacheCapacity = 0;
+  }
+  if (this->mode == DISK_MODE_URING) {
+    this->ring = new IoRing(IORING_DEFAULT_ENTRIES);
+  }
+
+  recoverJournal();
+}
+
+FileDisk::~FileDisk() {
+  if (isInTransaction) {
+    rollback();
+  }
+  if (!this->readOnly) {
+    checkpointJournal();
+  }
+  if (this->mapping != NULL) {
+    munmap(this->mapping, this->imageFileSize);
+  }
+  delete this->ring;
+  close(this->fd);
+  pthread_mutex_destroy(&this->transactionLock);
+  pthread_mutex_destroy(&this->syncLock);
+  pthread_cond_destroy(&this->syncCond);
+  pthread_mutex_destroy(&this->journalLock);
+  pthread_mutex_destroy(&this->cacheLock);
+  for (size_t i = 0; i < this->alignedBuffers.size(); i++) {
+    free(this->alignedBuffers[i]);
+  }
+  pthread_mutex_destroy(&this->poolLock);
+}
+
+// Flush the mapped blocks [low, high] back to the image file.
+void FileDisk::syncMapping(int low, int high) {
+  long pageSize = sysconf(_SC_PAGESIZE);
+  off_t start = (off_t) low * this->blockSize;
+  off_t end = (off_t) (high + 1) * this->blockSize;
+  start -= start % pageSize;
+  unsigned long began = nowUsec();
+  if (msync(this->mapping + start, end - start, MS_SYNC) != 0) {
+    perror("msync");
+    cerr << "Could not sync image file" << endl;
+    exit(1);
+  }
+  this->syscalls++;
+  this->diskStats.syncs++;
+  this->diskStats.syncLatency.record(nowUsec() - began);
+}
+
+int FileDisk::numberOfBlocks() {
+  if (this->journalLen > 0) {
+    return this->journalStart;
+  }
+  return this->totalBlocks;
+}
+
+unsigned long FileDisk::syscallCount() {
+  return this->syscalls.load();
+}
+
+// Count the blocks and bytes moved by requests, which took usec to finish.
+void FileDisk::recordRequests(const vector<IoRequest>& requests, bool write, unsigned long usec) {
+  unsigned long bytes = 0;
+  for (size_t r = 0; r < requests.size(); r++) {
+    for (size_t i = 0; i < requests[r].iov.size(); i++) {
+      bytes += requests[r].iov[i].iov_len;
+    }
+  }
+  if (write) {
+    this->diskStats.blocksWritten += bytes / this->blockSize;
+    this->diskStats.bytesWritten += bytes;
+    this->diskStats.writeLatency.record(usec);
+  } else {
+    this->diskStats.blocksRead += bytes / this->blockSize;
+    this->diskStats.bytesRead += bytes;
+    this->diskStats.readLatency.record(usec);
+  }
+}
+
+bool FileDisk::inOwnTransaction() {
+  return isInTransaction && pthread_equal(this->transactionOwner, pthread_self());
+}
+
+void FileDisk::readBlocks(const int *blockNumbers, int count, void *buffer) {
+  unsigned char *destination = (unsigned char *) buffer;
+  unsigned long generation = cacheGeneration();
+  vector<int> misses;
+  for (int i = 0; i < count; i++) {
+    if (blockNumbers[i] < 0 || blockNumbers[i] >= this->numberOfBlocks()) {
+      cerr << "Invalid block number " << blockNumbers[i] << endl;
+      exit(1);
+    }
+    if (!readBufferedBlock(blockNumbers[i], destination + (size_t) i * this->blockSize, generation)) {
+      misses.push_back(i);
+    }
+  }
+
+  // Whatever is left comes from the image, one readv per run of
+  // physically contiguous blocks
+  vector<IoRequest> requests;
+  size_t start = 0;
+  while (start < misses.size()) {
+    size_t end = start + 1;
+    while (end < misses.size() && end - start < DISK_MAX_IOVECS &&
+           blockNumbers[misses[end]] == blockNumbers[misses[end - 1]] + 1) {
+      end++;
+    }
+    IoRequest request;
+    request.opcode = IORING_OP_READV;
+    request.offset = (off_t) blockNumbers[misses[start]] * this->blockSize;
+    for (size_t i = start; i < end; i++) {
+      struct iovec entry;
+      entry.iov_base = destination + (size_t) misses[i] * this->blockSize;
+      entry.iov_len = this->blockSize;
+      request.iov.push_back(entry);
+    }
+    requests.push_back(request);
+    start = end;
+  }
+  readRequests(requests);
+  for (size_t i = 0; i < misses.size(); i++) {
+    cacheBlock(blockNumbers[misses[i]], destination + (size_t) misses[i] * this->blockSize, generation);
+  }
+}
+
+// Find a block without going to the image: our own uncommitted writes
+// come first, then the cache, then committed blocks that are still
+// waiting in the journal to be checkpointed. Blocks found in the journal
+// are cached if the cache is still at generation.
+bool FileDisk::readBufferedBlock(int blockNumber, void *buffer, unsigned long generation) {
+  if (inOwnTransaction()) {
+    map<int, vector<unsigned char> >::iterator iter = pending.find(blockNumber);
+    if (iter != pending.end()) {
+      memcpy(buffer, iter->second.data(), this->blockSize);
+      return true;
+    }
+    if (discards.count(blockNumber) != 0) {
+      memset(buffer, 0, this->blockSize);
+      return true;
+    }
+  }
+  if (readCachedBlock(blockNumber, buffer)) {
+    return true;
+  }
+  if (this->journalLen > 0) {
+    pthread_mutex_lock(&this->journalLock);
+    map<int, vector<unsigned char> >::iterator iter = journaled.find(blockNumber);
+    bool found = iter != journaled.end();
+    if (found) {
+      memcpy(buffer, iter->second.data(), this->blockSize);
+    }
+    pthread_mutex_unlock(&this->journalLock);
+    if (found) {
+      cacheBlock(blockNumber, buffer, generation);
+      return true;
+    }
+  }
+  return false;
+}
+
+void FileDisk::setCacheCapacity(int blocks) {
+  pthread_mutex_lock(&this->cacheLock);
+  this->cacheCapacity = this->mapping != NULL ? 0 : blocks;
+  cache.clear();
+  cacheOrder.clear();
+  pthread_mutex_unlock(&this->cacheLock);
+}
+
+unsigned long FileDisk::cacheHits() {
+  return this->hits;
+}
+
+unsigned long FileDisk::cacheMisses() {
+  return this->misses;
+}
+
+unsigned long FileDisk::cacheEvictions() {
+  return this->evictions;
+}
+
+// Copy a block out of the cache, returning false if it is not cached.
+bool FileDisk::readCachedBlock(int blockNumber, void *buffer) {
+  if (this->cacheCapacity <= 0) {
+    return false;
+  }
+  pthread_mutex_lock(&this->cacheLock);
+  unordered_map<int, CacheEntry>::iterator iter = cache.find(blockNumber);
+  bool found = iter != cache.end();
+  if (found) {
+    memcpy(buffer, iter->second.data.data(), this->blockSize);
+    cacheOrder.splice(cacheOrder.begin(), cacheOrder, iter->second.position);
+    this->hits++;
+  } else {
+    this->misses++;
+  }
+  pthread_mutex_unlock(&this->cacheLock);
+  return found;
+}
+
+// The cache generation, which every commit bumps. A block read from the
+// image or the journal may have been replaced by a commit that finished
+// while it was being read, so it is only cached if the generation taken
+// before the read is still current.
+unsigned long FileDisk::cacheGeneration() {
+  pthread_mutex_lock(&this->cacheLock);
+  unsigned long generation = this->generation;
+  pthread_mutex_unlock(&this->cacheLock);
+  return generation;
+}
+
+// Cache a block read at generation, unless a commit ran since.
+void FileDisk::cacheBlock(int blockNumber, const void *buffer, unsigned long generation) {
+  if (this->cacheCapacity <= 0) {
+    return;
+  }
+  pthread_mutex_lock(&this->cacheLock);
+  if (this->generation == generation) {
+    storeCachedBlock(blockNumber, buffer);
+  }
+  pthread_mutex_unlock(&this->cacheLock);
+}
+
+// Cache the image a commit just made visible, replacing the old one, and
+// start a new generation so reads that began earlier do not cache theirs.
+void FileDisk::cacheCommittedBlock(int blockNumber, const void *buffer) {
+  if (this->cacheCapacity <= 0) {
+    return;
+  }
+  pthread_mutex_lock(&this->cacheLock);
+  this->generation++;
+  storeCachedBlock(blockNumber, buffer);
+  pthread_mutex_unlock(&this->cacheLock);
+}
+
+// Remember the image of a block, evicting the least recently used block
+// when the cache is full. Callers hold cacheLock.
+void FileDisk::storeCachedBlock(int blockNumber, const void *buffer) {
+  const unsigned char *data = (const unsigned char *) buffer;
+  unordered_map<int, CacheEntry>::iterator iter = cache.find(blockNumber);
+  if (iter != cache.end()) {
+    iter->second.data.assign(data, data + this->blockSize);
+    cacheOrder.splice(cacheOrder.begin(), cacheOrder, iter->second.position);
+    return;
+  }
+
+  vector<unsigned char> image;
+  if ((int) cache.size() >= this->cacheCapacity) {
+    // reuse the evicted block's buffer for the new one
+    int victim = cacheOrder.back();
+    cacheOrder.pop_back();
+    image.swap(cache[victim].data);
+    cache.erase(victim);
+    this->evictions++;
+  }
+  image.assign(data, data + this->blockSize);
+  cacheOrder.push_front(blockNumber);
+  CacheEntry& entry = cache[blockNumber];
+  entry.data.swap(image);
+  entry.position = cacheOrder.begin();
+}
+
+void FileDisk::writeBlocks(const int *blockNumbers, int count, const void *buffer) {
+  for (int i = 0; i < count; i++) {
+    if (blockNumbers[i] < 0 || blockNumbers[i] >= this->numberOfBlocks()) {
+      cerr << "Invalid block number " << blockNumbers[i] << endl;
+      exit(1);
+    }
+  }
+
+  // A write outside of a transaction is a transaction of its own
+  if (!inOwnTransaction()) {
+    beginTransaction();
+    writeBlocks(blockNumbers, count, buffer);
+    commit();
+    return;
+  }
+
+  // Writing the same block again just replaces its pending image
+  const unsigned char *data = (const unsigned char *) buffer;
+  for (int i = 0; i < count; i++) {
+    const unsigned char *image = data + (size_t) i * this->blockSize;
+    pending[blockNumbers[i]].assign(image, image + this->blockSize);
+    discards.erase(blockNumbers[i]);
+  }
+}
+
+void FileDisk::discardBlock(int blockNumber) {
+  if (blockNumber < 0 || blockNumber >= this->numberOfBlocks()) {
+    cerr << "Invalid block number " << blockNumber << endl;
+    exit(1);
+  }
+
+  if (!inOwnTransaction()) {
+    beginTransaction();
+    discardBlock(blockNumber);
+    commit();
+    return;
+  }
+
+  pending.erase(blockNumber);
+  discards.insert(blockNumber);
+}
+
+// Punch a hole in the image for every discarded block, one fallocate per
+// run of contiguous blocks. Host file systems that cannot punch holes
+// get the zeros written instead.
+void FileDisk::discardBlockData() {
+  vector<unsigned char> zeros(this->blockSize, 0);
+  set<int>::iterator iter = discards.begin();
+  while (iter != discards.end()) {
+    int first = *iter;
+    int count = 0;
+    do {
+      // Committed copies waiting in the journal must not be checkpointed
+      // over the hole, and reads of it no longer need the image.
+      pthread_mutex_lock(&this->journalLock);
+      journaled.erase(*iter);
+      pthread_mutex_unlock(&this->journalLock);
+      iter++;
+      count++;
+    } while (iter != discards.end() && *iter == first + count);
+
+    off_t offset = (off_t) first * this->blockSize;
+    off_t length = (off_t) count * this->blockSize;
+    int ret = fallocate(this->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+    this->syscalls++;
+    this->diskStats.discards += count;
+    if (ret != 0 && errno == EOPNOTSUPP) {
+      for (int i = 0; i < count; i++) {
+        writeBlockData(first + i, 1, zeros.data());
+      }
+    } else if (ret != 0) {
+      perror("fallocate");
+      cerr << "Could not discard blocks of " << this->imageFile << endl;
+      exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+      cacheCommittedBlock(first + i, zeros.data());
+    }
+  }
+}
+
+// Read count consecutive blocks straight from the image.
+void FileDisk::readBlockData(int blockNumber, int count, void *buffer) {
+  vector<IoRequest> requests(1);
+  requests[0].opcode = IORING_OP_READV;
+  requests[0].offset = (off_t) blockNumber * this->blockSize;
+  requests[0].iov.resize(1);
+  requests[0].iov[0].iov_base = buffer;
+  requests[0].iov[0].iov_len = (size_t) count * this->blockSize;
+  readRequests(requests);
+}
+
+// Write count consecutive blocks straight to the image, without making
+// them durable.
+void FileDisk::writeBlockData(int blockNumber, int count, void *buffer) {
+  vector<IoRequest> requests(1);
+  requests[0].opcode = IORING_OP_WRITEV;
+  requests[0].offset = (off_t) blockNumber * this->blockSize;
+  requests[0].iov.resize(1);
+  requests[0].iov[0].iov_base = buffer;
+  requests[0].iov[0].iov_len = (size_t) count * this->blockSize;
+  writeRequests(requests, false);
+}
+
+// O_DIRECT transfers need block-aligned memory, so caller buffers are
+// staged through aligned blocks taken from a pool. Returns one aligned
+// iovec per block of iov, holding a copy of the data if copy is set.
+vector<struct iovec> FileDisk::acquireAlignedIovecs(const vector<struct iovec>& iov, bool copy) {
+  vector<struct iovec> aligned;
+  for (size_t i = 0; i < iov.size(); i++) {
+    for (size_t offset = 0; offset < iov[i].iov_len; offset += this->blockSize) {
+      struct iovec entry;
+      entry.iov_base = acquireAlignedBuffer();
+      entry.iov_len = this->blockSize;
+      if (copy) {
+        memcpy(entry.iov_base, (unsigned char *) iov[i].iov_base + offset, this->blockSize);
+      }
+      aligned.push_back(entry);
+    }
+  }
+  return aligned;
+}
+
+// Give the blocks from acquireAlignedIovecs back to the pool, first
+// copying their data out to iov if copy is set.
+void FileDisk::releaseAlignedIovecs(vector<struct iovec>& aligned, const vector<struct iovec>& iov, bool copy) {
+  size_t block = 0;
+  for (size_t i = 0; i < iov.size(); i++) {
+    for (size_t offset = 0; offset < iov[i].iov_len; offset += this->blockSize, block++) {
+      if (copy) {
+        memcpy((unsigned char *) iov[i].iov_base + offset, aligned[block].iov_base, this->blockSize);
+      }
+      releaseAlignedBuffer(aligned[block].iov_base);
+    }
+  }
+}
+
+void *FileDisk::acquireAlignedBuffer() {
+  void *buffer = NULL;
+  pthread_mutex_lock(&this->poolLock);
+  if (!this->alignedBuffers.empty()) {
+    buffer = this->alignedBuffers.back();
+    this->alignedBuffers.pop_back();
+  }
+  pthread_mutex_unlock(&this->poolLock);
+  if (buffer == NULL && posix_memalign(&buffer, DISK_DIRECT_ALIGNMENT, this->blockSize) != 0) {
+    cerr << "Could not allocate aligned buffer" << endl;
+    exit(1);
+  }
+  return buffer;
+}
+
+void FileDisk::releaseAlignedBuffer(void *buffer) {
+  pthread_mutex_lock(&this->poolLock);
+  this->alignedBuffers.push_back(buffer);
+  pthread_mutex_unlock(&this->poolLock);
+}
+
+// Read every request from the image. With io_uring they are all
+// submitted as one batch, otherwise each is a preadv of its own.
+void FileDisk::readRequests(vector<IoRequest>& requests) {
+  if (requests.empty()) {
+    return;
+  }
+  if (this->ring != NULL) {
+    unsigned long began = nowUsec();
+    this->syscalls += this->ring->submit(this->fd, requests, false);
+    recordRequests(requests, false, nowUsec() - began);
+    return;
+  }
+
+  for (size_t r = 0; r < requests.size(); r++) {
+    struct iovec *iov = requests[r].iov.data();
+    int iovcnt = requests[r].iov.size();
+    off_t offset = requests[r].offset;
+    unsigned long began = nowUsec();
+    if (this->mapping != NULL) {
+      for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, this->mapping + offset, iov[i].iov_len);
+        offset += iov[i].iov_len;
+      }
+      recordRequests(vector<IoRequest>(1, requests[r]), false, nowUsec() - began);
+      continue;
+    }
+
+    ssize_t length = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      length += iov[i].iov_len;
+    }
+    vector<struct iovec> aligned;
+    if (this->mode == DISK_MODE_DIRECT) {
+      aligned = acquireAlignedIovecs(requests[r].iov, false);
+      iov = aligned.data();
+      iovcnt = aligned.size();
+    }
+    ssize_t ret = preadv(this->fd, iov, iovcnt, offset);
+    this->syscalls++;
+    if (this->mode == DISK_MODE_DIRECT) {
+      releaseAlignedIovecs(aligned, requests[r].iov, ret == length);
+    }
+    if (ret != length) {
+      perror("read::preadv");
+      cerr << "Could not read file" << endl;
+      exit(1);
+    }
+    recordRequests(vector<IoRequest>(1, requests[r]), false, nowUsec() - began);
+  }
+}
+
+// Write every request to the image without making it durable, unless
+// sync is set and the writes can carry their own fdatasync: with
+// io_uring and no group commit window the writes are linked to an fsync
+// and submitted together. Returns true if the writes are durable.
+bool FileDisk::writeRequests(vector<IoRequest>& requests, bool sync) {
+  if (this->ring != NULL) {
+    sync = sync && this->groupCommitWindowUsec == 0;
+    if (sync) {
+      IoRequest request;
+      request.opcode = IORING_OP_FSYNC;
+      request.offset = 0;
+      requests.push_back(request);
+    }
+    unsigned long began = nowUsec();
+    this->syscalls += this->ring->submit(this->fd, requests, sync);
+    unsigned long usec = nowUsec() - began;
+    recordRequests(requests, true, usec);
+    if (sync) {
+      this->diskStats.syncs++;
+      this->diskStats.syncLatency.record(usec);
+    }
+    return sync;
+  }
+
+  for (size_t r = 0; r < requests.size(); r++) {
+    struct iovec *iov = requests[r].iov.data();
+    int iovcnt = requests[r].iov.size();
+    off_t offset = requests[r].offset;
+    unsigned long began = nowUsec();
+    if (this->mapping != NULL) {
+      if (this->readOnly) {
+        cerr << "Could not write file: " << this->imageFile << " is read-only" << endl;
+        exit(1);
+      }
+      for (int i = 0; i < iovcnt; i++) {
+        memcpy(this->mapping + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+      }
+      recordRequests(vector<IoRequest>(1, requests[r]), true, nowUsec() - began);
+      continue;
+    }
+
+    ssize_t length = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      length += iov[i].iov_len;
+    }
+    vector<struct iovec> aligned;
+    if (this->mode == DISK_MODE_DIRECT) {
+      aligned = acquireAlignedIovecs(requests[r].iov, true);
+      iov = aligned.data();
+      iovcnt = aligned.size();
+    }
+    ssize_t ret = pwritev(this->fd, iov, iovcnt, offset);
+    this->syscalls++;
+    if (this->mode == DISK_MODE_DIRECT) {
+      releaseAlignedIovecs(aligned, requests[r].iov, false);
+    }
+    if (ret != length) {
+      perror("write::pwritev");
+      cerr << "Could not write file" << endl;
+      exit(1);
+    }
+    recordRequests(vector<IoRequest>(1, requests[r]), true, nowUsec() - began);
+  }
+  return false;
+}
+
+// Write a set of block images to their home locations, one writev per
+// run of physically contiguous blocks. See writeRequests for sync.
+bool FileDisk::writeBlockMap(map<int, vector<unsigned char> >& blocks, bool sync) {
+  vector<IoRequest> requests;
+  map<int, vector<unsigned char> >::iterator iter = blocks.begin();
+  while (iter != blocks.end()) {
+    IoRequest request;
+    request.opcode = IORING_OP_WRITEV;
+    request.offset = (off_t) iter->first * this->blockSize;
+    int first = iter->first;
+    do {
+      struct iovec entry;
+      entry.iov_base = iter->second.data();
+      entry.iov_len = this->blockSize;
+      request.iov.push_back(entry);
+      iter++;
+    } while (iter != blocks.end() && request.iov.size() < DISK_MAX_IOVECS &&
+             iter->first == first + (int) request.iov.size());
+    requests.push_back(request);
+  }
+  return writeRequests(requests, sync);
+}
+
+void FileDisk::setGroupCommitWindow(int usec) {
+  this->groupCommitWindowUsec = usec;
+}
+
+// Make every block written by a finished transaction durable.
+//
+// Committers queue up behind a single fdatasync: the first one in becomes
+// the leader, optionally waits groupCommitWindowUsec for other
+// transactions to finish, and then issues one fdatasync on behalf of
+// everyone that committed before it started. Anyone who commits while
+// that flush is running waits for the next one.
+void FileDisk::groupSync() {
+  pthread_mutex_lock(&this->syncLock);
+  unsigned long ticket = ++this->syncRequested;
+  while (this->syncCompleted < ticket) {
+    if (this->syncing) {
+      pthread_cond_wait(&this->syncCond, &this->syncLock);
+      continue;
+    }
+
+    this->syncing = true;
+    if (this->groupCommitWindowUsec > 0) {
+      pthread_mutex_unlock(&this->syncLock);
+      usleep(this->groupCommitWindowUsec);
+      pthread_mutex_lock(&this->syncLock);
+    }
+    unsigned long batch = this->syncRequested;
+    pthread_mutex_unlock(&this->syncLock);
+
+    unsigned long began = nowUsec();
+    if (fdatasync(this->fd) != 0) {
+      perror("fdatasync");
+      cerr << "Could not sync image file" << endl;
+      exit(1);
+    }
+    this->diskStats.syncs++;
+    this->diskStats.syncLatency.record(nowUsec() - began);
+
+    pthread_mutex_lock(&this->syncLock);
+    this->syscalls++;
+    this->syncCompleted = batch;
+    this->syncing = false;
+    pthread_cond_broadcast(&this->syncCond);
+  }
+  pthread_mutex_unlock(&this->syncLock);
+}
+
+// Make the blocks [low, high] written by a finished transaction durable.
+void FileDisk::flush(int low, int high) {
+  if (low < 0) {
+    return;
+  }
+  if (this->mapping != NULL) {
+    syncMapping(low, high);
+  } else {
+    groupSync();
+  }
+}
+
+// Make everything written to the image so far durable.
+void FileDisk::syncAll() {
+  if (this->mapping != NULL) {
+    syncMapping(0, this->totalBlocks - 1);
+    return;
+  }
+  unsigned long began = nowUsec();
+  if (fdatasync(this->fd) != 0) {
+    perror("fdatasync");
+    cerr << "Could not sync image file" << endl;
+    exit(1);
+  }
+  this->syscalls++;
+  this->diskStats.syncs++;
+  this->diskStats.syncLatency.record(nowUsec() - began);
+}
+
+void FileDisk::beginTransaction() {
+  if (inOwnTransaction()) {
+    cerr << "You can't start a new transaction: one already exists" << endl;
+    exit(1);
+  }
+  // Transactions from other threads wait their turn
+  pthread_mutex_lock(&this->transactionLock);
+  this->transactionOwner = pthread_self();
+  this->transactionStartUsec = nowUsec();
+  isInTransaction = true;
+}
+
+void FileDisk::commit() {
+  isInTransaction = false;
+  this->diskStats.commits++;
+  unsigned long began = this->transactionStartUsec;
+  if (pending.empty() && discards.empty()) {
+    pthread_mutex_unlock(&this->transactionLock);
+    this->diskStats.transactionLatency.record(nowUsec() - began);
+    return;
+  }
+
+  int low = -1;
+  int high = -1;
+  bool durable = false;
+  int numBlocks = pending.size();
+  if (numBlocks == 0) {
+    // only discards
+  } else if (journalHasRoom(numBlocks)) {
+    low = this->journalStart + this->journalHead;
+    durable = appendJournal();
+    high = this->journalStart + this->journalHead - 1;
+  } else {
+    // No journal, or a transaction too big for it: write in place. Any
+    // journaled copies of these blocks must not shadow the new data.
+    checkpointJournal();
+    low = pending.begin()->first;
+    high = pending.rbegin()->first;
+    durable = writeBlockMap(pending, true);
+    map<int, vector<unsigned char> >::iterator iter;
+    for (iter = pending.begin(); iter != pending.end(); iter++) {
+      cacheCommittedBlock(iter->first, iter->second.data());
+    }
+  }
+  pending.clear();
+
+  if (discards.empty()) {
+    // Let the next transaction start while we wait for our flush, so
+    // that it can share the same fdatasync.
+    pthread_mutex_unlock(&this->transactionLock);
+    if (!durable) {
+      flush(low, high);
+    }
+    this->diskStats.transactionLatency.record(nowUsec() - began);
+    return;
+  }
+
+  // A discarded block is usually one this transaction just freed, so
+  // its old contents must stay on the image until the free is durable,
+  // and no one else may reuse it until the hole is punched.
+  if (!durable) {
+    flush(low, high);
+  }
+  discardBlockData();
+  discards.clear();
+  pthread_mutex_unlock(&this->transactionLock);
+  this->diskStats.transactionLatency.record(nowUsec() - began);
+}
+
+void FileDisk::rollback() {
+  // Nothing reached the image yet, so there is nothing to undo
+  isInTransaction = false;
+  this->diskStats.rollbacks++;
+  pending.clear();
+  discards.clear();
+  pthread_mutex_unlock(&this->transactionLock);
+}
+
+// Where block 0 of an image or overlay says its journal is, as long as
+// that is right after the region before it and ends the file. Returns
+// false if there is no journal.
+static bool journalLayout(const unsigned char *header, int totalBlocks, int *start, int *length) {
+  overlay_super_t overlay;
+  memcpy(&overlay, header, sizeof(overlay));
+  int regionEnd;
+  if (overlay.magic == UFS_OVERLAY_MAGIC) {
+    *start = overlay.journal_addr;
+    *length = overlay.journal_len;
+    regionEnd = 1 + overlay.table_len + overlay.num_blocks;
+  } else {
+    super_t super;
+    memcpy(&super, header, sizeof(super));
+    *start = super.journal_addr;
+    *length = super.journal_len;
+    regionEnd = super.data_region_addr + super.data_region_len;
+  }
+  return *length >= 2 && *start > 0 && *start == regionEnd && *start + *length + 1 == totalBlocks;
+}
+
+// Find the journal recorded in block 0 and replay any transactions that
+// were committed to it but not checkpointed. The last block of an image
+// without a journal is file data, so it is only read when block 0 says
+// it is the journal super block.
+void FileDisk::recoverJournal() {
+  if (this->blockSize != UFS_BLOCK_SIZE || this->totalBlocks < 4) {
+    return;
+  }
+
+  vector<unsigned char> block(this->blockSize);
+  int start, length;
+  readBlockData(0, 1, block.data());
+  if (!journalLayout(block.data(), this->totalBlocks, &start, &length)) {
+    return;
+  }
+  readBlockData(this->totalBlocks - 1, 1, block.data());
+  journal_super_t *journalSuper = (journal_super_t *) block.data();
+  if (journalSuper->magic != UFS_JOURNAL_MAGIC || journalSuper->journal_len != length) {
+    cerr << "Journal super block of " << this->imageFile << " does not match its super block" << endl;
+    exit(1);
+  }
+  this->journalLen = length;
+  this->journalStart = start;
+  this->journalSeq = journalSuper->checkpoint_seq;
+
+  // Records are valid up to the first one that is torn, out of sequence,
+  // or left over from before the last checkpoint
+  int position = 0;
+  while (position + 2 <= this->journalLen) {
+    journal_desc_t desc;
+    readBlockData(this->journalStart + position, 1, &desc);
+    int numBlocks = desc.num_blocks;
+    if (desc.magic != UFS_JOURNAL_DESC_MAGIC || desc.seq != this->journalSeq + 1 ||
+        numBlocks <= 0 || numBlocks > (int) JOURNAL_DESC_MAX_BLOCKS ||
+        position + numBlocks + 2 > this->journalLen) {
+      break;
+    }
+
+    // The checksum covers the descriptor too, so a record whose block
+    // numbers were torn is not replayed onto the wrong blocks
+    vector<unsigned char> record((size_t) (numBlocks + 1) * this->blockSize);
+    readBlockData(this->journalStart + position, numBlocks + 1, record.data());
+    memcpy(&desc, record.data(), sizeof(journal_desc_t));
+    unsigned char *images = record.data() + this->blockSize;
+    journal_commit_t commitBlock;
+    readBlockData(this->journalStart + position + numBlocks + 1, 1, block.data());
+    memcpy(&commitBlock, block.data(), sizeof(journal_commit_t));
+    if (commitBlock.magic != UFS_JOURNAL_COMMIT_MAGIC || commitBlock.seq != desc.seq ||
+        commitBlock.num_blocks != numBlocks ||
+        commitBlock.checksum != journalChecksum(record.data(), record.size())) {
+      break;
+    }
+
+    bool valid = true;
+    for (int i = 0; i < numBlocks; i++) {
+      if (desc.blocks[i] < 0 || desc.blocks[i] >= this->journalStart) {
+        valid = false;
+      }
+    }
+    if (!valid) {
+      break;
+    }
+    for (int i = 0; i < numBlocks; i++) {
+      unsigned char *image = images + (size_t) i * this->blockSize;
+      journaled[desc.blocks[i]].assign(image, image + this->blockSize);
+    }
+    this->journalSeq++;
+    position += numBlocks + 2;
+  }
+  this->journalHead = position;
+
+  // A read-only image keeps the replayed blocks in memory instead
+  if (!this->readOnly) {
+    checkpointJournal();
+  }
+}
+
+bool FileDisk::journalHasRoom(int numBlocks) {
+  if (this->journalLen == 0 || numBlocks > (int) JOURNAL_DESC_MAX_BLOCKS ||
+      numBlocks + 2 > this->journalLen) {
+    return false;
+  }
+  if (this->journalHead + numBlocks + 2 > this->journalLen) {
+    checkpointJournal();
+  }
+  return true;
+}
+
+// Append the pending transaction to the journal as one sequential write:
+// a descriptor block, the new block images, and a commit block. Returns
+// true if the record is already durable (see writeRequests).
+bool FileDisk::appendJournal() {
+  int numBlocks = pending.size();
+  vector<unsigned char> record((size_t) (numBlocks + 2) * this->blockSize, 0);
+
+  journal_desc_t *desc = (journal_desc_t *) record.data();
+  desc->magic = UFS_JOURNAL_DESC_MAGIC;
+  desc->seq = this->journalSeq + 1;
+  desc->num_blocks = numBlocks;
+
+  unsigned char *images = record.data() + this->blockSize;
+  int i = 0;
+  map<int, vector<unsigned char> >::iterator iter;
+  for (iter = pending.begin(); iter != pending.end(); iter++, i++) {
+    desc->blocks[i] = iter->first;
+    memcpy(images + (size_t) i * this->blockSize, iter->second.data(), this->blockSize);
+  }
+
+  journal_commit_t *commitBlock = (journal_commit_t *) (images + (size_t) numBlocks * this->blockSize);
+  commitBlock->magic = UFS_JOURNAL_COMMIT_MAGIC;
+  commitBlock->seq = desc->seq;
+  commitBlock->num_blocks = numBlocks;
+  commitBlock->checksum = journalChecksum(record.data(), (size_t) (numBlocks + 1) * this->blockSize);
+
+  vector<IoRequest> requests(1);
+  requests[0].opcode = IORING_OP_WRITEV;
+  requests[0].offset = (off_t) (this->journalStart + this->journalHead) * this->blockSize;
+  requests[0].iov.resize(1);
+  requests[0].iov[0].iov_base = record.data();
+  requests[0].iov[0].iov_len = record.size();
+  bool durable = writeRequests(requests, true);
+  this->journalHead += numBlocks + 2;
+  this->diskStats.journalRecords++;
+  this->journalSeq++;
+
+  // The cache only ever holds committed images, so the new ones go in
+  // as they become readable from the journal
+  pthread_mutex_lock(&this->journalLock);
+  for (iter = pending.begin(); iter != pending.end(); iter++) {
+    cacheCommittedBlock(iter->first, iter->second.data());
+    journaled[iter->first].swap(iter->second);
+  }
+  pthread_mutex_unlock(&this->journalLock);
+  return durable;
+}
+
+// Write every journaled block to its home location and empty the journal.
+void FileDisk::checkpointJournal() {
+  if (this->journalLen == 0 || (this->journalHead == 0 && journaled.empty())) {
+    return;
+  }
+
+  // The journal records have to be durable before anything they describe
+  // is written in place, and the blocks in place before the journal is
+  // marked empty.
+  syncAll();
+  pthread_mutex_lock(&this->journalLock);
+  writeBlockMap(journaled, false);
+  syncAll();
+
+  vector<unsigned char> block(this->blockSize, 0);
+  journal_super_t *journalSuper = (journal_super_t *) block.data();
+  journalSuper->magic = UFS_JOURNAL_MAGIC;
+  journalSuper->journal_len = this->journalLen;
+  journalSuper->checkpoint_seq = this->journalSeq;
+  writeBlockData(this->totalBlocks - 1, 1, block.data());
+  syncAll();
+
+  journaled.clear();
+  this->journalHead = 0;
+  this->diskStats.checkpoints++;
+  pthread_mutex_unlock(&this->journalLock);
+}
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "IoRing.h"
+
+using namespace std;
+
+IoRing::IoRing(int entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  this->ringFd = syscall(__NR_io_uring_setup, entries, &params);
+  if (this->ringFd < 0) {
+    perror("io_uring_setup");
+    cerr << "Could not set up io_uring" << endl;
+    exit(1);
+  }
+  pthread_mutex_init(&this->ringLock, NULL);
+  pthread_cond_init(&this->ringCond, NULL);
+  this->inFlight = 0;
+  this->reaping = false;
+
+  // Newer kernels map both rings with a single mmap
+  this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMmap && this->cqRingSize > this->sqRingSize) {
+    this->sqRingSize = this->cqRingSize;
+  }
+  this->sqRing = mmap(NULL, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      this->ringFd, IORING_OFF_SQ_RING);
+  if (this->sqRing == MAP_FAILED) {
+    perror("mmap");
+    cerr << "Could not map io_uring submission queue" << endl;
+    exit(1);
+  }
+  if (singleMmap) {
+    this->cqRing = this->sqRing;
+  } else {
+    this->cqRing = mmap(NULL, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        this->ringFd, IORING_OFF_CQ_RING);
+    if (this->cqRing == MAP_FAILED) {
+      perror("mmap");
+      cerr << "Could not map io_uring completion queue" << endl;
+      exit(1);
+    }
+  }
+  this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *addr = mmap(NULL, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    this->ringFd, IORING_OFF_SQES);
+  if (addr == MAP_FAILED) {
+    perror("mmap");
+    cerr << "Could not map io_uring submission entries" << endl;
+    exit(1);
+  }
+  this->sqes = (struct io_uring_sqe *) addr;
+
+  unsigned char *sq = (unsigned char *) this->sqRing;
+  this->sqHead = (unsigned int *) (sq + params.sq_off.head);
+  this->sqTail = (unsigned int *) (sq + params.sq_off.tail);
+  this->sqMask = (unsigned int *) (sq + params.sq_off.ring_mask);
+  this->sqArray = (unsigned int *) (sq + params.sq_off.array);
+  this->sqEntries = params.sq_entries;
+
+  unsigned char *cq = (unsigned char *) this->cqRing;
+  this->cqHead = (unsigned int *) (cq + params.cq_off.head);
+  this->cqTail = (unsigned int *) (cq + params.cq_off.tail);
+  this->cqMask = (unsigned int *) (cq + params.cq_off.ring_mask);
+  this->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+}
+
+IoRing::~IoRing() {
+  munmap(this->sqes, this->sqesSize);
+  if (this->cqRing != this->sqRing) {
+    munmap(this->cqRing, this->cqRingSize);
+  }
+  munmap(this->sqRing, this->sqRingSize);
+  close(this->ringFd);
+  pthread_mutex_destroy(&this->ringLock);
+  pthread_cond_destroy(&this->ringCond);
+}
+
+int IoRing::enter(unsigned int toSubmit, unsigned int minComplete) {
+  int ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, this->ringFd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    perror("io_uring_enter");
+    cerr << "Could not submit to io_uring" << endl;
+    exit(1);
+  }
+  return ret;
+}
+
+// Take every completion the kernel has posted and count it against the
+// batch it belongs to. Callers hold ringLock.
+void IoRing::reap() {
+  unsigned int head = *this->cqHead;
+  unsigned int cqTail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+  for (; head != cqTail; head++) {
+    struct io_uring_cqe *cqe = &this->cqes[head & *this->cqMask];
+    IoCompletion *completion = (IoCompletion *) cqe->user_data;
+    if (cqe->res != completion->expected) {
+      cerr << "io_uring request failed: " << (cqe->res < 0 ? strerror(-cqe->res) : "short transfer") << endl;
+      exit(1);
+    }
+    (*completion->remaining)--;
+    this->inFlight--;
+  }
+  __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+}
+
+int IoRing::submit(int fd, vector<IoRequest>& requests, bool linked) {
+  int calls = 0;
+  vector<IoCompletion> completions(requests.size());
+  pthread_mutex_lock(&this->ringLock);
+
+  size_t next = 0;
+  while (next < requests.size()) {
+    // At most a queue's worth is in flight, so the completion queue
+    // (twice as deep) cannot overflow
+    unsigned int count = min(requests.size() - next, (size_t) this->sqEntries);
+    while (this->inFlight + count > this->sqEntries) {
+      pthread_cond_wait(&this->ringCond, &this->ringLock);
+    }
+
+    // Fill the submission queue with as much of the batch as fits
+    unsigned int remaining = count;
+    unsigned int tail = *this->sqTail;
+    for (unsigned int i = 0; i < count; i++) {
+      IoRequest& request = requests[next + i];
+      IoCompletion& completion = completions[next + i];
+      completion.remaining = &remaining;
+      completion.expected = 0;
+      for (size_t j = 0; j < request.iov.size(); j++) {
+        completion.expected += request.iov[j].iov_len;
+      }
+
+      unsigned int index = (tail + i) & *this->sqMask;
+      struct io_uring_sqe *sqe = &this->sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = request.opcode;
+      sqe->fd = fd;
+      sqe->off = request.offset;
+      if (request.opcode == IORING_OP_FSYNC) {
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+      } else {
+        sqe->addr = (unsigned long) request.iov.data();
+        sqe->len = request.iov.size();
+      }
+      sqe->user_data = (unsigned long) &completion;
+      this->sqArray[index] = index;
+      if (linked && i + 1 < count) {
+        sqe->flags |= IOSQE_IO_LINK;
+      }
+    }
+    __atomic_store_n(this->sqTail, tail + count, __ATOMIC_RELEASE);
+    unsigned int submitted = 0;
+    while (submitted < count) {
+      submitted += enter(count - submitted, 0);
+      calls++;
+    }
+    this->inFlight += count;
+
+    // One thread at a time waits in the kernel and reaps completions for
+    // everyone; the rest wait for it to hand theirs over
+    while (remaining > 0) {
+      if (this->reaping) {
+        pthread_cond_wait(&this->ringCond, &this->ringLock);
+        continue;
+      }
+      this->reaping = true;
+      pthread_mutex_unlock(&this->ringLock);
+      enter(0, 1);
+      calls++;
+      pthread_mutex_lock(&this->ringLock);
+      reap();
+      this->reaping = false;
+      pthread_cond_broadcast(&this->ringCond);
+    }
+    next += count;
+  }
+
+  pthread_mutex_unlock(&this->ringLock);
+  return calls;
+}
@@ -1,129 +1,20 @@
 #include "LocalFileSystem.h"
 #include "ufs.h"
+#include <algorithm>
 #include <assert.h>
-#include <bitset>
 #include <climits>
 #include <cmath>
 #include <cstring>
 #include <iostream>
+#include <list>
+#include <map>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 using namespace std;
 
-static int findFirstFreeBit(unsigned char* bitmap, size_t bitmapBytes, size_t totalBits)
-{
-    for (size_t i = 0; i < bitmapBytes; i++) {
-        bitset<8> bits(bitmap[i]);
-        // Skip fully used bytes
-        if (bits.all()) {
-            continue;
-        }
-        // Find first 0 bit in this byte
-        for (int j = 0; j < 8; j++) {
-            // Don't exceed total bits
-            size_t bitIndex = (i * 8) + j;
-            if (bitIndex >= totalBits) {
-                return -1;
-            }
-            if (!bits[j]) { // If bit is 0 (not set)
-                return bitIndex;
-            }
-        }
-    }
-    return -1;
-}
-
-// Set a bit at position
-static void setBit(unsigned char* bitmap, const int position)
-{
-    int byteIndex = position / 8;
-    int bitOffset = position % 8;
-    bitmap[byteIndex] |= (1 << bitOffset);
-}
-
-// Set a bit at position
-static void clearBit(unsigned char* bitmap, const int position)
-{
-    int byteIndex = position / 8;
-    int bitOffset = position % 8;
-    bitmap[byteIndex] &= ~(1 << bitOffset);
-}
-
-static int allocateInode(LocalFileSystem* const fs, super_t* super)
-{
-    // Process Inode bitmap
-    size_t inodeBitmapBytes = static_cast<int>(ceil(super->num_inodes / 8.0));
-    unsigned char* inodeBitmap = new unsigned char[inodeBitmapBytes];
-    fs->readInodeBitmap(super, inodeBitmap);
-    // Find first free bit (free inode)
-    int freeInodeIndex = findFirstFreeBit(inodeBitmap, inodeBitmapBytes, super->num_inodes);
-    if (freeInodeIndex < 0) {
-        delete[] inodeBitmap;
-        return -ENOTENOUGHSPACE;
-    }
-    setBit(inodeBitmap, freeInodeIndex); // Set bit in bitmap
-    fs->writeInodeBitmap(super, inodeBitmap); // Write bitmap to disk
-    delete[] inodeBitmap;
-    return freeInodeIndex;
-}
-
-static int deallocateInode(LocalFileSystem* const fs, super_t* super, int inodeToFree)
-{
-    // Process Inode bitmap
-    size_t inodeBitmapBytes = static_cast<int>(ceil(super->num_inodes / 8.0));
-    unsigned char* inodeBitmap = new unsigned char[inodeBitmapBytes];
-    fs->readInodeBitmap(super, inodeBitmap);
-    clearBit(inodeBitmap, inodeToFree); // Set bit in bitmap
-    fs->writeInodeBitmap(super, inodeBitmap); // Write bitmap to disk
-    delete[] inodeBitmap;
-    return 0;
-}
-
-static int deallocateDataBlock(LocalFileSystem* const fs, super_t* const super, int dataBlock)
-{
-    // Process Data bitmap
-    size_t dataBitmapBytes = static_cast<int>(ceil(super->num_data / 8.0));
-    unsigned char* dataBitmap = new unsigned char[dataBitmapBytes];
-    fs->readDataBitmap(super, dataBitmap);
-    int dataBlockToFree = dataBlock - super->data_region_addr;
-
-    // Validate dataBlockToFree is within range
-    if (dataBlockToFree < 0 || dataBlockToFree >= super->num_data) {
-        delete[] dataBitmap;
-        return -1;
-    }
-    clearBit(dataBitmap, dataBlockToFree); // clear bit in bitmap
-    fs->writeDataBitmap(super, dataBitmap); // Write bitmap to disk
-    // Clear the block with zeros
-    char emptyBlock[UFS_BLOCK_SIZE] = { 0 };
-    fs->disk->writeBlock(dataBlock, emptyBlock);
-    delete[] dataBitmap;
-    return 0;
-}
-
-static int allocateDataBlock(LocalFileSystem* const fs, super_t* const super)
-{
-    // Process Data bitmap
-    size_t dataBitmapBytes = static_cast<int>(ceil(super->num_data / 8.0));
-    unsigned char* dataBitmap = new unsigned char[dataBitmapBytes];
-    fs->readDataBitmap(super, dataBitmap);
-
-    // Find first free bit (free block)
-    int freeDataBlockIndex = findFirstFreeBit(dataBitmap, dataBitmapBytes, super->num_data);
-    int actualDataBlock = freeDataBlockIndex + super->data_region_addr;
-    if (freeDataBlockIndex < 0) {
-        delete[] dataBitmap;
-        return -ENOTENOUGHSPACE;
-    }
-    setBit(dataBitmap, freeDataBlockIndex); // Set bit in bitmap
-    fs->writeDataBitmap(super, dataBitmap); // Write bitmap to disk
-    char emptyBlock[UFS_BLOCK_SIZE] = { 0 }; // Initialize the block with zeros
-    fs->disk->writeBlock(actualDataBlock, emptyBlock);
-    delete[] dataBitmap;
-    return actualDataBlock;
-}
-
 static int validateInodeNumber(int parentInodeNumber, int amountOfNodes)
 {
     return (parentInodeNumber < 0 || parentInodeNumber >= amountOfNodes) ? -EINVALIDINODE : 0;
@@ -156,6 +47,304 @@ static int validateCreateParameters(LocalFileSystem* const fs, super_t* const su
     return 0;
 }
 
+// Largest file the image's inode version can describe, in bytes
+static long maxFileSize(const super_t* super)
+{
+    return super->version >= UFS_VERSION_INDIRECT ? MAX_FILE_SIZE_V2 : MAX_FILE_SIZE;
+}
+
+// Whether a file keeps its data in direct[], and its type without that flag
+static bool isInline(const inode_t& inode)
+{
+    return (inode.type & UFS_INLINE_DATA) != 0;
+}
+
+static int inodeType(const inode_t& inode)
+{
+    return inode.type & ~UFS_INLINE_DATA;
+}
+
+/**
+ * The block pointers of one file: inode.direct[] alone in a version 1
+ * image, and in a version 2 image the indirect blocks as well (see
+ * ufs.h). Indirect blocks are read the first time they are needed and
+ * kept, changes included, until flush(), so mapping a run of file blocks
+ * reads and writes each indirect block along it once.
+ */
+class FileBlockMap {
+public:
+    FileBlockMap(LocalFileSystem* const fs, const super_t* super, inode_t& inode)
+        : fs(fs), indirect(super->version >= UFS_VERSION_INDIRECT), inode(inode)
+    {
+    }
+
+    // Data block holding file block index, or UINT_MAX if there is none
+    unsigned int get(size_t index)
+    {
+        unsigned int owner;
+        unsigned int* pointer = slot(index, false, owner);
+        return pointer != NULL ? *pointer : UINT_MAX;
+    }
+
+    // The data blocks holding file blocks [first, first + count)
+    void get(size_t first, size_t count, vector<int>& blocks)
+    {
+        blocks.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            blocks[i] = get(first + i);
+        }
+    }
+
+    // Point file block index at block, allocating indirect blocks on the
+    // way. Returns 0, or -ENOTENOUGHSPACE if an indirect block could not
+    // be allocated.
+    int set(size_t index, unsigned int block)
+    {
+        unsigned int owner;
+        unsigned int* pointer = slot(index, true, owner);
+        if (pointer == NULL) {
+            return -ENOTENOUGHSPACE;
+        }
+        *pointer = block;
+        if (owner != UINT_MAX) {
+            this->dirty.insert(owner);
+        }
+        return 0;
+    }
+
+    // Free file blocks [newCount, oldCount) and the indirect blocks that
+    // only mapped those. Returns 0, or -1 if a pointer was not a data block.
+    int truncate(size_t newCount, size_t oldCount)
+    {
+        for (size_t i = newCount; i < oldCount; i++) {
+            unsigned int block = get(i);
+            if (block == UINT_MAX) {
+                continue;
+            }
+            if (this->fs->freeDataBlock(block) != 0) {
+                return -1;
+            }
+            set(i, UINT_MAX);
+        }
+        if (!this->indirect) {
+            return 0;
+        }
+
+        size_t doubleStart = DIRECT_PTRS_V2 + INDIRECT_PTRS;
+        if (this->inode.direct[DOUBLE_INDIRECT_PTR] != UINT_MAX) {
+            unsigned int* top = pointers(this->inode.direct[DOUBLE_INDIRECT_PTR]);
+            for (size_t k = 0; k < INDIRECT_PTRS; k++) {
+                if (top[k] != UINT_MAX && newCount <= doubleStart + k * INDIRECT_PTRS) {
+                    if (freeIndirect(top[k]) != 0) {
+                        return -1;
+                    }
+                    this->dirty.insert(this->inode.direct[DOUBLE_INDIRECT_PTR]);
+                }
+            }
+            if (newCount <= doubleStart && freeIndirect(this->inode.direct[DOUBLE_INDIRECT_PTR]) != 0) {
+                return -1;
+            }
+        }
+        if (this->inode.direct[INDIRECT_PTR] != UINT_MAX && newCount <= DIRECT_PTRS_V2 &&
+            freeIndirect(this->inode.direct[INDIRECT_PTR]) != 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    // The indirect blocks in use by the first count file blocks
+    void indirectBlocks(size_t count, vector<int>& blocks)
+    {
+        if (!this->indirect) {
+            return;
+        }
+        if (count > DIRECT_PTRS_V2 && this->inode.direct[INDIRECT_PTR] != UINT_MAX) {
+            blocks.push_back(this->inode.direct[INDIRECT_PTR]);
+        }
+        size_t doubleStart = DIRECT_PTRS_V2 + INDIRECT_PTRS;
+        if (count > doubleStart && this->inode.direct[DOUBLE_INDIRECT_PTR] != UINT_MAX) {
+            blocks.push_back(this->inode.direct[DOUBLE_INDIRECT_PTR]);
+            unsigned int* top = pointers(this->inode.direct[DOUBLE_INDIRECT_PTR]);
+            for (size_t k = 0; k < INDIRECT_PTRS && doubleStart + k * INDIRECT_PTRS < count; k++) {
+                if (top[k] != UINT_MAX) {
+                    blocks.push_back(top[k]);
+                }
+            }
+        }
+    }
+
+    // Write the indirect blocks that changed, in one request
+    void flush()
+    {
+        if (this->dirty.empty()) {
+            return;
+        }
+        vector<int> blocks(this->dirty.begin(), this->dirty.end());
+        vector<unsigned int> buffer;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            vector<unsigned int>& block = this->loaded[blocks[i]];
+            buffer.insert(buffer.end(), block.begin(), block.end());
+        }
+        this->fs->disk->writeBlocks(blocks.data(), blocks.size(), buffer.data());
+        this->dirty.clear();
+    }
+
+private:
+    // The pointer to file block index, and in owner the indirect block it
+    // is in (UINT_MAX for the inode). Missing indirect blocks on the way
+    // are allocated if allocate is set; otherwise, or if that fails,
+    // returns NULL.
+    unsigned int* slot(size_t index, bool allocate, unsigned int& owner)
+    {
+        owner = UINT_MAX;
+        size_t directPointers = this->indirect ? DIRECT_PTRS_V2 : DIRECT_PTRS;
+        if (index < directPointers) {
+            return &this->inode.direct[index];
+        }
+        if (!this->indirect) {
+            return NULL;
+        }
+
+        index -= DIRECT_PTRS_V2;
+        if (index < INDIRECT_PTRS) {
+            if (!present(this->inode.direct[INDIRECT_PTR], UINT_MAX, allocate)) {
+                return NULL;
+            }
+            owner = this->inode.direct[INDIRECT_PTR];
+            return &pointers(owner)[index];
+        }
+
+        index -= INDIRECT_PTRS;
+        if (index >= INDIRECT_PTRS * INDIRECT_PTRS ||
+            !present(this->inode.direct[DOUBLE_INDIRECT_PTR], UINT_MAX, allocate)) {
+            return NULL;
+        }
+        unsigned int top = this->inode.direct[DOUBLE_INDIRECT_PTR];
+        unsigned int& second = pointers(top)[index / INDIRECT_PTRS];
+        if (!present(second, top, allocate)) {
+            return NULL;
+        }
+        owner = second;
+        return &pointers(owner)[index % INDIRECT_PTRS];
+    }
+
+    // Make sure pointer (held in block owner) points to an indirect block
+    bool present(unsigned int& pointer, unsigned int owner, bool allocate)
+    {
+        if (pointer != UINT_MAX) {
+            return true;
+        }
+        if (!allocate) {
+            return false;
+        }
+        int block = this->fs->allocateDataBlock();
+        if (block < 0) {
+            return false;
+        }
+        this->loaded[block].assign(INDIRECT_PTRS, UINT_MAX);
+        this->dirty.insert(block);
+        pointer = block;
+        if (owner != UINT_MAX) {
+            this->dirty.insert(owner);
+        }
+        return true;
+    }
+
+    // The pointers in an indirect block, read in if need be
+    unsigned int* pointers(unsigned int block)
+    {
+        map<unsigned int, vector<unsigned int> >::iterator iter = this->loaded.find(block);
+        if (iter == this->loaded.end()) {
+            iter = this->loaded.insert(make_pair(block, vector<unsigned int>(INDIRECT_PTRS))).first;
+            this->fs->disk->readBlock(block, iter->second.data());
+        }
+        return iter->second.data();
+    }
+
+    int freeIndirect(unsigned int& pointer)
+    {
+        if (this->fs->freeDataBlock(pointer) != 0) {
+            return -1;
+        }
+        this->loaded.erase(pointer);
+        this->dirty.erase(pointer);
+        pointer = UINT_MAX;
+        return 0;
+    }
+
+    LocalFileSystem* fs;
+    bool indirect;
+    inode_t& inode;
+    map<unsigned int, vector<unsigned int> > loaded;
+    std::set<unsigned int> dirty;
+};
+
+// Map file blocks [from, to) to newly allocated blocks, as one contiguous
+// extent when there is a free run that long, and return how many were
+// mapped (fewer than asked only when the disk is full)
+static size_t allocateFileBlocks(LocalFileSystem* const fs, FileBlockMap& blockMap, size_t from, size_t to)
+{
+    if (to <= from) {
+        return 0;
+    }
+    int extentStart = fs->allocateDataBlocks(to - from);
+    if (extentStart >= 0) {
+        for (size_t i = from; i < to; i++) {
+            if (blockMap.set(i, extentStart + (i - from)) != 0) {
+                // No room for an indirect block: give back the rest
+                for (size_t j = i; j < to; j++) {
+                    fs->freeDataBlock(extentStart + (j - from));
+                }
+                return i - from;
+            }
+        }
+        return to - from;
+    }
+
+    // Too fragmented for one extent: take free blocks one at a time
+    size_t i;
+    for (i = from; i < to; i++) {
+        int newBlockNum = fs->allocateDataBlock();
+        if (newBlockNum < 0) {
+            break;
+        }
+        if (blockMap.set(i, newBlockNum) != 0) {
+            fs->freeDataBlock(newBlockNum);
+            break;
+        }
+    }
+    return i - from;
+}
+
+// Write count blocks from data, of which only the first size bytes are
+// valid: whole blocks straight from data, the last partial one zero padded
+static void writeFileBlocks(LocalFileSystem* const fs, const vector<int>& blocks, const char* data, size_t size)
+{
+    size_t wholeBlocks = min(blocks.size(), size / UFS_BLOCK_SIZE);
+    if (wholeBlocks > 0) {
+        fs->disk->writeBlocks(blocks.data(), wholeBlocks, data);
+    }
+    if (wholeBlocks < blocks.size()) {
+        vector<char> lastBlock(UFS_BLOCK_SIZE, 0);
+        memcpy(lastBlock.data(), data + wholeBlocks * UFS_BLOCK_SIZE, size - wholeBlocks * UFS_BLOCK_SIZE);
+        fs->disk->writeBlock(blocks[wholeBlocks], lastBlock.data());
+    }
+}
+
+// Read the first size bytes held by blocks into buffer
+static void readFileBlocks(LocalFileSystem* const fs, const vector<int>& blocks, char* buffer, size_t size)
+{
+    size_t wholeBlocks = min(blocks.size(), size / UFS_BLOCK_SIZE);
+    if (wholeBlocks > 0) {
+        fs->disk->readBlocks(blocks.data(), wholeBlocks, buffer);
+    }
+    if (wholeBlocks < blocks.size()) {
+        vector<char> lastBlock(UFS_BLOCK_SIZE);
+        fs->disk->readBlock(blocks[wholeBlocks], lastBlock.data());
+        memcpy(buffer + wholeBlocks * UFS_BLOCK_SIZE, lastBlock.data(), size - wholeBlocks * UFS_BLOCK_SIZE);
+    }
+}
+
 static int writeData(LocalFileSystem* const fs, super_t* const super, inode_t& inode, char* data, size_t dataSize, size_t oldSize)
 {
     size_t blocksNeeded = std::ceil(static_cast<double>(dataSize) / UFS_BLOCK_SIZE);
@@ -166,68 +355,48 @@ static int writeData(LocalFileSystem* const fs, super_t* const super, inode_t& i
             inode.direct[j] = UINT_MAX;
         }
     }
+    FileBlockMap blockMap(fs, super, inode);
 
     // DeAllocate blocks if needed
     if (blocksNeeded < allocatedBlocks) {
-        for (size_t i = blocksNeeded; i < allocatedBlocks; i++) {
-            int isFreeBlock = deallocateDataBlock(fs, super, inode.direct[i]);
-            if (isFreeBlock != 0) {
-                return -1;
-            }
-            inode.direct[i] = UINT_MAX;
+        if (blockMap.truncate(blocksNeeded, allocatedBlocks) != 0) {
+            return -1;
         }
+        blockMap.flush();
 
         if (blocksNeeded == 0) {
             return 0;
         }
     }
 
-    // Allocate additional blocks if needed
+    // Allocate additional blocks if needed, as one contiguous extent so
+    // that the file can be read back with a single request
     if (blocksNeeded > allocatedBlocks) {
-        int actualBlocksAllocated = allocatedBlocks; // keep track of allocated blocks (needed if allocating fails)
-        for (size_t i = allocatedBlocks; i < blocksNeeded; i++) {
-            int newBlockNum = allocateDataBlock(fs, super);
-            if (newBlockNum < 0) {
-                blocksNeeded = actualBlocksAllocated; // No more disk space
-                break;
-            }
-            inode.direct[i] = newBlockNum;
-            actualBlocksAllocated++;
-        }
+        size_t actualBlocksAllocated = allocatedBlocks + allocateFileBlocks(fs, blockMap, allocatedBlocks, blocksNeeded);
+        blockMap.flush();
 
         // 0 blocks were allocated (no space for more)
         if (actualBlocksAllocated == 0) {
             return -ENOTENOUGHSPACE;
         }
+        blocksNeeded = actualBlocksAllocated; // No more disk space
     }
 
-    if (blocksNeeded > 0 && inode.direct[0] < 0) {
-        return -ENOTENOUGHSPACE;
-    }
-
-    // Write data to blocks
-    size_t bytesWritten = 0;
-    char bufferToWrite[UFS_BLOCK_SIZE];
-
-    for (size_t i = 0; i < blocksNeeded; i++) {
-        size_t blockToWrite = inode.direct[i];
-        size_t destOffset = i * UFS_BLOCK_SIZE;
-        size_t bytesToCopy = min(static_cast<size_t>(UFS_BLOCK_SIZE), static_cast<size_t>(dataSize - bytesWritten));
-        memset(bufferToWrite, 0, UFS_BLOCK_SIZE);
-        memcpy(bufferToWrite, data + destOffset, bytesToCopy);
-        fs->disk->writeBlock(blockToWrite, bufferToWrite);
-        bytesWritten += bytesToCopy;
-    }
+    // Write data to blocks, zero padding the last one
+    size_t bytesWritten = min(dataSize, blocksNeeded * UFS_BLOCK_SIZE);
+    vector<int> blocksToWrite;
+    blockMap.get(0, blocksNeeded, blocksToWrite);
+    writeFileBlocks(fs, blocksToWrite, data, bytesWritten);
 
     return bytesWritten;
 }
 
-static vector<dir_ent_t> readDirectoryEntries(LocalFileSystem* const fs, const vector<inode_t>& inodes, int dirInodeNumber)
+static vector<dir_ent_t> readDirectoryEntries(LocalFileSystem* const fs, int dirInodeNumber)
 {
     // create inode/dir_ent stuctures
     vector<dir_ent_t> dirEntries;
-    inode_t dirInode = inodes.at(dirInodeNumber);
-    if (dirInode.type != UFS_DIRECTORY) {
+    inode_t dirInode;
+    if (fs->stat(dirInodeNumber, &dirInode) != 0 || dirInode.type != UFS_DIRECTORY) {
         return dirEntries; // Return empty vector if not directory
     }
     // Read directory data
@@ -249,137 +418,426 @@ static vector<dir_ent_t> readDirectoryEntries(LocalFileSystem* const fs, const v
     return dirEntries;
 }
 
-static int writeDirectoryEntries(LocalFileSystem* const fs, super_t* const super, vector<inode_t>& inodes, int dirInodeNumber, const vector<dir_ent_t>& dirEntries)
+// Append one entry to a directory. Only its last block is written: the
+// one the entry lands in, read first if it already holds entries, or a
+// newly allocated one when the directory fills its last block exactly.
+static int addDirectoryEntry(LocalFileSystem* const fs, super_t* const super, int parentInodeNumber, int newInodeNum, string name)
 {
-    inode_t& dirInode = inodes.at(dirInodeNumber);
-    if (dirInode.type != UFS_DIRECTORY) {
+    inode_t dirInode;
+    if (fs->stat(parentInodeNumber, &dirInode) != 0 || dirInode.type != UFS_DIRECTORY) {
         return -EINVALIDTYPE;
     }
-    // Calculate old and new sizes
-    size_t oldDirSize = dirInode.size;
-    size_t newDirSize = dirEntries.size() * sizeof(dir_ent_t);
-
-    // Prepare directory data for writing to disk
-    char* newDirBuffer = new char[newDirSize];
-    memset(newDirBuffer, 0, newDirSize);
-
-    // Copy entries into buffer
-    for (size_t j = 0; j < dirEntries.size(); j++) {
-        memcpy(newDirBuffer + (j * sizeof(dir_ent_t)), &dirEntries.at(j), sizeof(dir_ent_t));
+    size_t offset = dirInode.size;
+    if (static_cast<long>(offset + sizeof(dir_ent_t)) > maxFileSize(super)) {
+        return -ENOTENOUGHSPACE;
     }
-    dirInode.size = newDirSize;
-
-    // Write the directory data to disk
-    int bytesWritten = writeData(fs, super, dirInode, newDirBuffer, newDirSize, oldDirSize);
-    delete[] newDirBuffer;
-    return bytesWritten;
-}
 
-static int addDirectoryEntry(LocalFileSystem* const fs, super_t* const super, vector<inode_t>& inodes, int parentInodeNumber, int newInodeNum, string name)
-{
-    vector<dir_ent_t> dirEntries = readDirectoryEntries(fs, inodes, parentInodeNumber);
     dir_ent_t newDirEntry; // Create new directory entry
+    memset(&newDirEntry, 0, sizeof(newDirEntry));
     newDirEntry.inum = newInodeNum;
     strncpy(newDirEntry.name, name.c_str(), sizeof(newDirEntry.name) - 1);
-    newDirEntry.name[sizeof(newDirEntry.name) - 1] = '\0';
-    dirEntries.push_back(newDirEntry); // Add new entry
 
-    // Write updated entries back
-    return writeDirectoryEntries(fs, super, inodes, parentInodeNumber, dirEntries);
+    FileBlockMap blockMap(fs, super, dirInode);
+    size_t blockIndex = offset / UFS_BLOCK_SIZE;
+    vector<char> block(UFS_BLOCK_SIZE, 0);
+    if (offset % UFS_BLOCK_SIZE == 0) {
+        if (allocateFileBlocks(fs, blockMap, blockIndex, blockIndex + 1) != 1) {
+            return -ENOTENOUGHSPACE;
+        }
+        blockMap.flush();
+    } else {
+        fs->disk->readBlock(blockMap.get(blockIndex), block.data());
+    }
+    memcpy(block.data() + offset % UFS_BLOCK_SIZE, &newDirEntry, sizeof(dir_ent_t));
+    fs->disk->writeBlock(blockMap.get(blockIndex), block.data());
+
+    dirInode.size = offset + sizeof(dir_ent_t);
+    fs->writeInode(parentInodeNumber, dirInode);
+    return sizeof(dir_ent_t);
 }
 
-static int removeDirectoryEntry(LocalFileSystem* const fs, super_t* const super, vector<inode_t>& inodes, int parentInodeNumber, string name)
+// Remove one entry from a directory by moving its last entry into the
+// hole, so at most two blocks are written: the one the entry was in and
+// the last one, whose vacated slot is zeroed (or which is freed once it
+// holds no entries). Returns 0 whether or not name was there.
+static int removeDirectoryEntry(LocalFileSystem* const fs, super_t* const super, int parentInodeNumber, string name)
 {
-    vector<dir_ent_t> dirEntries = readDirectoryEntries(fs, inodes, parentInodeNumber);
-    // remove entry
-    for (int i = 0; i < static_cast<int>(dirEntries.size()); i++) {
-        if (strcmp(dirEntries.at(i).name, name.c_str()) == 0) {
-            dirEntries.erase(dirEntries.begin() + i);
-            break;
+    inode_t dirInode;
+    if (fs->stat(parentInodeNumber, &dirInode) != 0 || dirInode.type != UFS_DIRECTORY) {
+        return -EINVALIDTYPE;
+    }
+    vector<dir_ent_t> dirEntries = readDirectoryEntries(fs, parentInodeNumber);
+    size_t removed = 0;
+    while (removed < dirEntries.size() && strcmp(dirEntries[removed].name, name.c_str()) != 0) {
+        removed++;
+    }
+    if (removed == dirEntries.size()) {
+        return 0;
+    }
+
+    size_t last = dirEntries.size() - 1;
+    dirEntries[removed] = dirEntries[last];
+    memset(&dirEntries[last], 0, sizeof(dir_ent_t));
+
+    FileBlockMap blockMap(fs, super, dirInode);
+    size_t entriesPerBlock = UFS_BLOCK_SIZE / sizeof(dir_ent_t);
+    size_t blockCount = last / entriesPerBlock + 1;
+    size_t newBlockCount = std::ceil(static_cast<double>(last * sizeof(dir_ent_t)) / UFS_BLOCK_SIZE);
+
+    // Each changed block that is kept is rebuilt from the entries read
+    set<size_t> changed;
+    if (removed != last) {
+        changed.insert(removed / entriesPerBlock);
+    }
+    changed.insert(last / entriesPerBlock);
+    vector<int> blocks;
+    vector<char> buffer;
+    for (set<size_t>::iterator iter = changed.begin(); iter != changed.end() && *iter < newBlockCount; iter++) {
+        size_t first = *iter * entriesPerBlock;
+        size_t count = min(entriesPerBlock, dirEntries.size() - first);
+        size_t start = buffer.size();
+        buffer.resize(start + UFS_BLOCK_SIZE, 0);
+        memcpy(buffer.data() + start, &dirEntries[first], count * sizeof(dir_ent_t));
+        blocks.push_back(blockMap.get(*iter));
+    }
+    if (!blocks.empty()) {
+        fs->disk->writeBlocks(blocks.data(), blocks.size(), buffer.data());
+    }
+    if (newBlockCount < blockCount) {
+        if (blockMap.truncate(newBlockCount, blockCount) != 0) {
+            return -1;
         }
+        blockMap.flush();
     }
-    return writeDirectoryEntries(fs, super, inodes, parentInodeNumber, dirEntries);
+
+    dirInode.size = last * sizeof(dir_ent_t);
+    fs->writeInode(parentInodeNumber, dirInode);
+    return 0;
 }
 
 LocalFileSystem::LocalFileSystem(Disk* disk)
+    : superBlockValid(false), superBlockHits(0), dataBitmap(true), directoryIndexClock(0),
+      inodeCacheCapacity(LFS_INODE_CACHE_BYTES / sizeof(inode_t)), inodeCacheGeneration(0), inodeCacheHits(0),
+      isInTransaction(false)
 {
     this->disk = disk;
+    pthread_mutex_init(&this->superBlockLock, NULL);
+    pthread_mutex_init(&this->directoryIndexLock, NULL);
+    pthread_mutex_init(&this->inodeCacheLock, NULL);
+    super_t super;
+    this->readSuperBlock(&super);
+    this->inodeBitmap.load(disk, super.inode_bitmap_addr, super.inode_bitmap_len, super.num_inodes);
+    this->dataBitmap.load(disk, super.data_bitmap_addr, super.data_bitmap_len, super.num_data);
+}
+
+LocalFileSystem::~LocalFileSystem()
+{
+    pthread_mutex_destroy(&this->superBlockLock);
+    pthread_mutex_destroy(&this->directoryIndexLock);
+    pthread_mutex_destroy(&this->inodeCacheLock);
 }
 
 void LocalFileSystem::readSuperBlock(super_t* super)
 {
+    pthread_mutex_lock(&this->superBlockLock);
+    if (this->superBlockValid) {
+        *super = this->superBlock;
+        pthread_mutex_unlock(&this->superBlockLock);
+        this->superBlockHits++;
+        return;
+    }
     char buffer[UFS_BLOCK_SIZE];
     this->disk->readBlock(0, buffer);
-    memcpy(super, buffer, sizeof(super_t));
+    memcpy(&this->superBlock, buffer, sizeof(super_t));
+    this->superBlockValid = true;
+    *super = this->superBlock;
+    pthread_mutex_unlock(&this->superBlockLock);
+}
+
+void LocalFileSystem::invalidateSuperBlock()
+{
+    pthread_mutex_lock(&this->superBlockLock);
+    this->superBlockValid = false;
+    pthread_mutex_unlock(&this->superBlockLock);
+}
+
+unsigned long LocalFileSystem::superBlockReadsAvoided()
+{
+    return this->superBlockHits;
+}
+
+unsigned long LocalFileSystem::inodeReadsAvoided()
+{
+    return this->inodeCacheHits;
 }
 
 void LocalFileSystem::readInodeBitmap(super_t* super, unsigned char* inodeBitmap)
 {
-    int inode_bitmap_block = super->inode_bitmap_addr;
-    char buffer[UFS_BLOCK_SIZE];
-    this->disk->readBlock(inode_bitmap_block, buffer);
-    memcpy(inodeBitmap, buffer, static_cast<int>(std::ceil(super->num_inodes / 8.0)));
+    this->inodeBitmap.copyTo(inodeBitmap);
 }
 
 // Inode bitmap bits are allocated when creating new file/directories
 void LocalFileSystem::writeInodeBitmap(super_t* super, unsigned char* inodeBitmap)
 {
-    int inode_bitmap_block = super->inode_bitmap_addr;
-    char buffer[UFS_BLOCK_SIZE];
-    memcpy(buffer, inodeBitmap, static_cast<int>(std::ceil(super->num_inodes / 8.0)));
-    this->disk->writeBlock(inode_bitmap_block, buffer);
+    this->inodeBitmap.copyFrom(inodeBitmap);
+    this->inodeBitmap.flush(this->disk);
 }
 
 void LocalFileSystem::readDataBitmap(super_t* super, unsigned char* dataBitmap)
 {
-    int data_bitmap_block = super->data_bitmap_addr;
-    char buffer[UFS_BLOCK_SIZE];
-    this->disk->readBlock(data_bitmap_block, buffer);
-    memcpy(dataBitmap, buffer, static_cast<int>(std::ceil(super->num_data / 8.0)));
+    this->dataBitmap.copyTo(dataBitmap);
 }
 
 // data bitmap bits are allocated when writing file content
 void LocalFileSystem::writeDataBitmap(super_t* super, unsigned char* dataBitmap)
 {
-    int data_bitmap_block = super->data_bitmap_addr;
-    char buffer[UFS_BLOCK_SIZE];
-    memcpy(buffer, dataBitmap, static_cast<int>(std::ceil(super->num_data / 8.0)));
-    this->disk->writeBlock(data_bitmap_block, buffer);
+    this->dataBitmap.copyFrom(dataBitmap);
+    this->dataBitmap.flush(this->disk);
+}
+
+int LocalFileSystem::allocateInode()
+{
+    // An allocation outside of an operation is an operation of its own
+    if (!this->inOwnTransaction()) {
+        this->beginTransaction();
+        int inodeNumber = this->allocateInode();
+        this->commitTransaction();
+        return inodeNumber;
+    }
+    int inodeNumber = this->inodeBitmap.allocate();
+    return inodeNumber < 0 ? -ENOTENOUGHSPACE : inodeNumber;
+}
+
+void LocalFileSystem::freeInode(int inodeNumber)
+{
+    if (!this->inOwnTransaction()) {
+        this->beginTransaction();
+        this->freeInode(inodeNumber);
+        this->commitTransaction();
+        return;
+    }
+    this->inodeBitmap.clear(inodeNumber);
+}
+
+int LocalFileSystem::allocateDataBlock()
+{
+    if (!this->inOwnTransaction()) {
+        this->beginTransaction();
+        int blockNumber = this->allocateDataBlock();
+        this->commitTransaction();
+        return blockNumber;
+    }
+    super_t super;
+    this->readSuperBlock(&super);
+    int index = this->dataBitmap.allocate();
+    if (index < 0) {
+        return -ENOTENOUGHSPACE;
+    }
+    int blockNumber = index + super.data_region_addr;
+    this->disk->discardBlock(blockNumber); // Initialize the block with zeros
+    return blockNumber;
+}
+
+int LocalFileSystem::allocateDataBlocks(int count)
+{
+    if (!this->inOwnTransaction()) {
+        this->beginTransaction();
+        int firstBlock = this->allocateDataBlocks(count);
+        this->commitTransaction();
+        return firstBlock;
+    }
+    super_t super;
+    this->readSuperBlock(&super);
+    int index = this->dataBitmap.allocateRun(count);
+    if (index < 0) {
+        return -ENOTENOUGHSPACE;
+    }
+    int firstBlock = index + super.data_region_addr;
+    for (int blockNumber = firstBlock; blockNumber < firstBlock + count; blockNumber++) {
+        this->disk->discardBlock(blockNumber);
+    }
+    return firstBlock;
+}
+
+int LocalFileSystem::freeDataBlock(int blockNumber)
+{
+    if (!this->inOwnTransaction()) {
+        this->beginTransaction();
+        int rc = this->freeDataBlock(blockNumber);
+        this->commitTransaction();
+        return rc;
+    }
+    super_t super;
+    this->readSuperBlock(&super);
+    int index = blockNumber - super.data_region_addr;
+    if (index < 0 || index >= super.num_data) {
+        return -1;
+    }
+    this->dataBitmap.clear(index);
+    // Clear the block without writing zeros to it
+    this->disk->discardBlock(blockNumber);
+    return 0;
+}
+
+int LocalFileSystem::writeInode(int inodeNumber, const inode_t& inode)
+{
+    super_t super;
+    this->readSuperBlock(&super);
+    if (validateInodeNumber(inodeNumber, super.num_inodes) != 0) {
+        return -EINVALIDINODE;
+    }
+
+    // An update outside of an operation is an operation of its own
+    if (!this->inOwnTransaction()) {
+        this->beginTransaction();
+        this->writeInode(inodeNumber, inode);
+        this->commitTransaction();
+        return 0;
+    }
+    this->dirtyInodes[inodeNumber] = inode;
+    return 0;
+}
+
+bool LocalFileSystem::inOwnTransaction()
+{
+    return this->isInTransaction && pthread_equal(this->transactionOwner, pthread_self());
+}
+
+void LocalFileSystem::beginTransaction()
+{
+    this->disk->beginTransaction();
+    this->transactionOwner = pthread_self();
+    this->isInTransaction = true;
+}
+
+// Patch the dirty inodes into their inode blocks, so an operation writes
+// the one or two inode blocks it touched instead of the whole region
+void LocalFileSystem::flushInodes()
+{
+    if (this->dirtyInodes.empty()) {
+        return;
+    }
+    super_t super;
+    this->readSuperBlock(&super);
+    size_t inodes_per_block = UFS_BLOCK_SIZE / sizeof(inode_t);
+
+    vector<int> blocks;
+    for (map<int, inode_t>::iterator iter = this->dirtyInodes.begin(); iter != this->dirtyInodes.end(); iter++) {
+        int block = super.inode_region_addr + iter->first / inodes_per_block;
+        if (blocks.empty() || blocks.back() != block) {
+            blocks.push_back(block);
+        }
+    }
+    vector<char> buffer(blocks.size() * UFS_BLOCK_SIZE);
+    this->disk->readBlocks(blocks.data(), blocks.size(), buffer.data());
+
+    size_t position = 0;
+    for (map<int, inode_t>::iterator iter = this->dirtyInodes.begin(); iter != this->dirtyInodes.end(); iter++) {
+        int block = super.inode_region_addr + iter->first / inodes_per_block;
+        while (blocks[position] != block) {
+            position++;
+        }
+        size_t offset = position * UFS_BLOCK_SIZE + (iter->first % inodes_per_block) * sizeof(inode_t);
+        memcpy(buffer.data() + offset, &iter->second, sizeof(inode_t));
+    }
+    this->disk->writeBlocks(blocks.data(), blocks.size(), buffer.data());
+    this->dirtyInodes.clear();
+}
+
+void LocalFileSystem::commitTransaction()
+{
+    vector<int> directories;
+    for (map<int, inode_t>::iterator iter = this->dirtyInodes.begin(); iter != this->dirtyInodes.end(); iter++) {
+        if (iter->second.type == UFS_DIRECTORY) {
+            directories.push_back(iter->first);
+        }
+    }
+    map<int, inode_t> changedInodes = this->dirtyInodes;
+
+    this->flushInodes();
+    this->inodeBitmap.flush(this->disk);
+    this->dataBitmap.flush(this->disk);
+    this->isInTransaction = false;
+    this->disk->commit();
+
+    // Write the committed inodes through to the inode cache
+    pthread_mutex_lock(&this->inodeCacheLock);
+    if (!changedInodes.empty()) {
+        this->inodeCacheGeneration++;
+    }
+    for (map<int, inode_t>::iterator iter = changedInodes.begin(); iter != changedInodes.end(); iter++) {
+        this->cacheInode(iter->first, iter->second);
+    }
+    pthread_mutex_unlock(&this->inodeCacheLock);
+
+    // Once the new entries are on disk, bring the indexes of the changed
+    // directories up to date, or drop them if the operation changed them
+    // some other way; a new generation also stops a lookup that read the
+    // old entries from installing them
+    pthread_mutex_lock(&this->directoryIndexLock);
+    for (size_t i = 0; i < directories.size(); i++) {
+        DirectoryIndex& index = this->directoryIndex(directories[i]);
+        map<int, vector<pair<string, int> > >::iterator changes = this->directoryChanges.find(directories[i]);
+        if (index.built && changes != this->directoryChanges.end()) {
+            for (size_t j = 0; j < changes->second.size(); j++) {
+                if (changes->second[j].second == -ENOTFOUND) {
+                    index.names.erase(changes->second[j].first);
+                } else {
+                    index.names[changes->second[j].first] = changes->second[j].second;
+                }
+            }
+        } else {
+            index.names.clear();
+            index.built = false;
+        }
+        index.generation = ++this->directoryIndexClock;
+    }
+    pthread_mutex_unlock(&this->directoryIndexLock);
+    this->directoryChanges.clear();
+}
+
+void LocalFileSystem::rollbackTransaction()
+{
+    this->dirtyInodes.clear();
+    this->directoryChanges.clear();
+    this->inodeBitmap.revert();
+    this->dataBitmap.revert();
+    this->isInTransaction = false;
+    this->disk->rollback();
 }
 
 void LocalFileSystem::readInodeRegion(super_t* super, inode_t* inodes)
 {
-    size_t inode_region_block = super->inode_region_addr;
-    char buffer[UFS_BLOCK_SIZE];
     size_t inodes_per_block = UFS_BLOCK_SIZE / sizeof(inode_t);
     size_t num_inodes = super->num_inodes;
-    size_t amountOfBlocks = super->inode_region_len;
+    size_t amountOfBlocks = min(static_cast<size_t>(super->inode_region_len), (num_inodes + inodes_per_block - 1) / inodes_per_block);
+    vector<int> blocks(amountOfBlocks);
     for (size_t i = 0; i < amountOfBlocks; i++) {
-        this->disk->readBlock(inode_region_block + i, buffer);
-        size_t inodes_to_copy = min(inodes_per_block, num_inodes - (i * inodes_per_block));
-        if (inodes_to_copy <= 0) {
-            break;
-        }
-        // Copy inodes from the buffer to the inodes array
-        memcpy(&inodes[i * inodes_per_block], buffer, inodes_to_copy * sizeof(inode_t));
+        blocks[i] = super->inode_region_addr + i;
     }
+
+    // Read the whole region at once, then copy out the inodes
+    vector<char> buffer(amountOfBlocks * UFS_BLOCK_SIZE);
+    this->disk->readBlocks(blocks.data(), amountOfBlocks, buffer.data());
+    memcpy(inodes, buffer.data(), min(num_inodes, amountOfBlocks * inodes_per_block) * sizeof(inode_t));
 }
 
+// Every inode goes through the dirty set, so the inode cache is updated
+// along with the region
 void LocalFileSystem::writeInodeRegion(super_t* super, inode_t* inodes)
 {
     size_t inodes_per_block = UFS_BLOCK_SIZE / sizeof(inode_t);
-    size_t num_inodes = super->num_inodes;
-    size_t amountOfBlocks = super->inode_region_len;
-    size_t inode_region_block = super->inode_region_addr;
-    char buffer[UFS_BLOCK_SIZE];
-    for (size_t i = 0; i < amountOfBlocks; i++) {
-        size_t inodes_to_copy = min(inodes_per_block, num_inodes - (i * inodes_per_block)); // how many inodes to copy from array
-        if (inodes_to_copy <= 0) {
-            break;
-        }
-        memset(buffer, 0, UFS_BLOCK_SIZE);
-        memcpy(buffer, &inodes[i * inodes_per_block], inodes_to_copy * sizeof(inode_t)); // copy inodes from inodes array to buffer
-        this->disk->writeBlock(inode_region_block + i, buffer);
+    size_t num_inodes = min(static_cast<size_t>(super->num_inodes), super->inode_region_len * inodes_per_block);
+
+    bool ownTransaction = !this->inOwnTransaction();
+    if (ownTransaction) {
+        this->beginTransaction();
+    }
+    for (size_t i = 0; i < num_inodes; i++) {
+        this->writeInode(i, inodes[i]);
+    }
+    if (ownTransaction) {
+        this->commitTransaction();
     }
 }
 
@@ -395,6 +853,22 @@ int LocalFileSystem::lookup(int parentInodeNumber, string name)
         return -EINVALIDINODE;
     }
 
+    // A directory this thread's operation has changed is not indexed yet
+    bool useIndex = !(this->inOwnTransaction() && this->dirtyInodes.count(parentInodeNumber) != 0);
+    unsigned long generation = 0;
+    if (useIndex) {
+        pthread_mutex_lock(&this->directoryIndexLock);
+        DirectoryIndex& index = this->directoryIndex(parentInodeNumber);
+        if (index.built) {
+            unordered_map<string, int>::iterator entry = index.names.find(name);
+            int inodeNumber = entry != index.names.end() ? entry->second : -ENOTFOUND;
+            pthread_mutex_unlock(&this->directoryIndexLock);
+            return inodeNumber;
+        }
+        generation = index.generation;
+        pthread_mutex_unlock(&this->directoryIndexLock);
+    }
+
     // Read in raw data
     char* buffer = new char[dirSize];
     if (this->read(parentInodeNumber, buffer, dirSize) != static_cast<int>(dirSize)) {
@@ -402,46 +876,159 @@ int LocalFileSystem::lookup(int parentInodeNumber, string name)
         return -EINVALIDINODE;
     }
 
-    // Iterate through directory entires
+    // Iterate through directory entires, indexing all of them
+    int found = -ENOTFOUND;
+    unordered_map<string, int> names;
     size_t amountOfEntiresToRead = dirSize / sizeof(dir_ent_t);
     for (size_t j = 0; j < amountOfEntiresToRead; j++) {
         dir_ent_t dirEntry;
         memcpy(&dirEntry, buffer + (j * sizeof(dir_ent_t)), sizeof(dir_ent_t));
-        if (strcmp(dirEntry.name, name.c_str()) == 0) {
-            delete[] buffer;
-            return dirEntry.inum;
+        dirEntry.name[sizeof(dirEntry.name) - 1] = '\0';
+        if (found == -ENOTFOUND && strcmp(dirEntry.name, name.c_str()) == 0) {
+            found = dirEntry.inum;
+        }
+        if (useIndex) {
+            names.insert(make_pair(string(dirEntry.name), dirEntry.inum));
         }
     }
-
     delete[] buffer;
-    return -ENOTFOUND;
+
+    // Keep the index unless a commit changed the directory meanwhile
+    if (useIndex) {
+        pthread_mutex_lock(&this->directoryIndexLock);
+        if (this->directoryIndexes.size() > LFS_DIRECTORY_INDEX_MAX) {
+            this->directoryIndexes.clear();
+            this->directoryIndexClock++;
+        }
+        DirectoryIndex& index = this->directoryIndex(parentInodeNumber);
+        if (index.generation == generation) {
+            index.names.swap(names);
+            index.built = true;
+        }
+        pthread_mutex_unlock(&this->directoryIndexLock);
+    }
+    return found;
+}
+
+// The index entry for a directory, created empty if there is none. Every
+// generation handed out is new, so one taken before the entry was dropped
+// or changed never matches it again. Callers hold directoryIndexLock.
+LocalFileSystem::DirectoryIndex& LocalFileSystem::directoryIndex(int inodeNumber)
+{
+    unordered_map<int, DirectoryIndex>::iterator iter = this->directoryIndexes.find(inodeNumber);
+    if (iter == this->directoryIndexes.end()) {
+        iter = this->directoryIndexes.insert(make_pair(inodeNumber, DirectoryIndex())).first;
+        iter->second.generation = this->directoryIndexClock;
+    }
+    return iter->second;
 }
 
 int LocalFileSystem::stat(int inodeNumber, inode_t* inode)
+{
+    return this->statMany(&inodeNumber, 1, inode);
+}
+
+int LocalFileSystem::statMany(const int* inodeNumbers, int count, inode_t* inodes)
+{
+    int rc = this->readInodes(inodeNumbers, count, inodes);
+    if (rc != 0) {
+        return rc;
+    }
+    for (int i = 0; i < count; i++) {
+        inodes[i].type = inodeType(inodes[i]);
+    }
+    return 0;
+}
+
+int LocalFileSystem::readInodes(const int* inodeNumbers, int count, inode_t* inodes)
 {
     super_t super;
     this->readSuperBlock(&super);
 
-    // Check if inode number is valid
-    int inodeValidation = validateInodeNumber(inodeNumber, super.num_inodes);
-    if (inodeValidation != 0) {
-        return inodeValidation;
+    // Check if inode numbers are valid
+    for (int i = 0; i < count; i++) {
+        int inodeValidation = validateInodeNumber(inodeNumbers[i], super.num_inodes);
+        if (inodeValidation != 0) {
+            return inodeValidation;
+        }
     }
 
-    // Calculation inode offset & block offset
-    size_t inodes_per_block = UFS_BLOCK_SIZE / sizeof(inode_t);
-    size_t block_offset = inodeNumber / inodes_per_block;
-    size_t inode_block = super.inode_region_addr + block_offset;
-    size_t inode_offset_in_block = inodeNumber % inodes_per_block;
+    // An inode changed by this thread's operation is not on disk yet;
+    // after those, take what the inode cache has
+    bool inTransaction = this->inOwnTransaction();
+    vector<int> misses;
+    pthread_mutex_lock(&this->inodeCacheLock);
+    unsigned long generation = this->inodeCacheGeneration;
+    for (int i = 0; i < count; i++) {
+        if (inTransaction) {
+            map<int, inode_t>::iterator dirty = this->dirtyInodes.find(inodeNumbers[i]);
+            if (dirty != this->dirtyInodes.end()) {
+                inodes[i] = dirty->second;
+                continue;
+            }
+        }
+        unordered_map<int, InodeList::iterator>::iterator cached = this->inodeCacheIndex.find(inodeNumbers[i]);
+        if (cached != this->inodeCacheIndex.end()) {
+            this->inodeCache.splice(this->inodeCache.begin(), this->inodeCache, cached->second);
+            inodes[i] = cached->second->second;
+            this->inodeCacheHits++;
+            continue;
+        }
+        misses.push_back(i);
+    }
+    pthread_mutex_unlock(&this->inodeCacheLock);
+    if (misses.empty()) {
+        return 0;
+    }
 
-    // Copy bytes from disk block to buffer & then into inode stuct
-    char buffer[UFS_BLOCK_SIZE];
-    this->disk->readBlock(inode_block, buffer);
-    memcpy(inode, buffer + (inode_offset_in_block * sizeof(inode_t)), sizeof(inode_t));
+    // Read every inode block holding a missing inode, each once, in a
+    // single request
+    size_t inodes_per_block = UFS_BLOCK_SIZE / sizeof(inode_t);
+    vector<int> blocks;
+    for (size_t i = 0; i < misses.size(); i++) {
+        blocks.push_back(super.inode_region_addr + inodeNumbers[misses[i]] / inodes_per_block);
+    }
+    sort(blocks.begin(), blocks.end());
+    blocks.erase(unique(blocks.begin(), blocks.end()), blocks.end());
+    vector<char> buffer(blocks.size() * UFS_BLOCK_SIZE);
+    this->disk->readBlocks(blocks.data(), blocks.size(), buffer.data());
+
+    // Copy the inodes out, caching them unless a commit changed inodes
+    // since the cache was searched
+    pthread_mutex_lock(&this->inodeCacheLock);
+    bool fill = generation == this->inodeCacheGeneration;
+    for (size_t i = 0; i < misses.size(); i++) {
+        int inodeNumber = inodeNumbers[misses[i]];
+        int block = super.inode_region_addr + inodeNumber / inodes_per_block;
+        size_t position = lower_bound(blocks.begin(), blocks.end(), block) - blocks.begin();
+        size_t offset = position * UFS_BLOCK_SIZE + (inodeNumber % inodes_per_block) * sizeof(inode_t);
+        memcpy(&inodes[misses[i]], buffer.data() + offset, sizeof(inode_t));
+        if (fill) {
+            this->cacheInode(inodeNumber, inodes[misses[i]]);
+        }
+    }
+    pthread_mutex_unlock(&this->inodeCacheLock);
 
     return 0;
 }
 
+// Add or replace a cached inode, evicting the least recently used ones
+// past the capacity. Callers hold inodeCacheLock.
+void LocalFileSystem::cacheInode(int inodeNumber, const inode_t& inode)
+{
+    unordered_map<int, InodeList::iterator>::iterator cached = this->inodeCacheIndex.find(inodeNumber);
+    if (cached != this->inodeCacheIndex.end()) {
+        this->inodeCache.erase(cached->second);
+    }
+    this->inodeCache.push_front(make_pair(inodeNumber, inode));
+    this->inodeCacheIndex[inodeNumber] = this->inodeCache.begin();
+
+    while (this->inodeCache.size() > this->inodeCacheCapacity) {
+        this->inodeCacheIndex.erase(this->inodeCache.back().first);
+        this->inodeCache.pop_back();
+    }
+}
+
 int LocalFileSystem::read(int inodeNumber, void* buffer, int size)
 {
     if (size < 0) {
@@ -450,34 +1037,185 @@ int LocalFileSystem::read(int inodeNumber, void* buffer, int size)
 
     // Find the inode
     inode_t inode;
-    if (this->stat(inodeNumber, &inode) != 0) {
+    if (this->readInodes(&inodeNumber, 1, &inode) != 0) {
         return -EINVALIDINODE;
     }
 
-    size_t blocksNeeded = std::ceil(static_cast<double>(inode.size) / UFS_BLOCK_SIZE);
     size_t bytesToRead = min(static_cast<size_t>(size), static_cast<size_t>(inode.size));
-    size_t bytesRead = 0;
+    size_t blocksNeeded = std::ceil(static_cast<double>(bytesToRead) / UFS_BLOCK_SIZE);
+    size_t bytesRead = bytesToRead;
+    if (isInline(inode)) {
+        memcpy(buffer, inode.direct, bytesRead);
+        return bytesRead;
+    }
 
-    // Read the raw bytes from the direct blocks
-    for (size_t i = 0; i < blocksNeeded; i++) {
-        char blockBuffer[UFS_BLOCK_SIZE];
-        this->disk->readBlock(inode.direct[i], blockBuffer);
+    // Read the raw bytes from the file's blocks, the whole ones straight
+    // into the buffer in a single request
+    super_t super;
+    this->readSuperBlock(&super);
+    FileBlockMap blockMap(this, &super, inode);
+    vector<int> blocksToRead;
+    blockMap.get(0, blocksNeeded, blocksToRead);
+    readFileBlocks(this, blocksToRead, static_cast<char*>(buffer), bytesRead);
 
-        // Calculate where in the destination buffer this block goes
-        size_t destOffset = i * UFS_BLOCK_SIZE; // Offset in destination buffer to start writing from
-        size_t bytesToCopy = min(static_cast<size_t>(UFS_BLOCK_SIZE), static_cast<size_t>(bytesToRead - bytesRead));
+    return bytesRead;
+}
 
-        memcpy((char*)buffer + (destOffset), blockBuffer, bytesToCopy);
-        bytesRead += bytesToCopy;
+int LocalFileSystem::fileBlocks(int inodeNumber, vector<int>& dataBlocks, vector<int>* indirectBlocks)
+{
+    inode_t inode;
+    if (this->readInodes(&inodeNumber, 1, &inode) != 0) {
+        return -EINVALIDINODE;
     }
+    if (isInline(inode)) {
+        return 0;
+    }
+    super_t super;
+    this->readSuperBlock(&super);
+    size_t blocks = std::ceil(static_cast<double>(inode.size) / UFS_BLOCK_SIZE);
+    FileBlockMap blockMap(this, &super, inode);
+    blockMap.get(0, blocks, dataBlocks);
+    if (indirectBlocks != NULL) {
+        blockMap.indirectBlocks(blocks, *indirectBlocks);
+    }
+    return 0;
+}
 
-    return bytesRead;
+int LocalFileSystem::pread(int inodeNumber, void* buffer, int size, int offset)
+{
+    if (size < 0 || offset < 0) {
+        return -EINVALIDSIZE;
+    }
+
+    inode_t inode;
+    if (this->readInodes(&inodeNumber, 1, &inode) != 0) {
+        return -EINVALIDINODE;
+    }
+    if (size == 0 || offset >= inode.size) {
+        return 0;
+    }
+
+    // Read only the blocks that hold [offset, offset + bytesToRead)
+    size_t bytesToRead = min(static_cast<size_t>(size), static_cast<size_t>(inode.size - offset));
+    if (isInline(inode)) {
+        memcpy(buffer, reinterpret_cast<char*>(inode.direct) + offset, bytesToRead);
+        return bytesToRead;
+    }
+    size_t firstBlock = offset / UFS_BLOCK_SIZE;
+    size_t lastBlock = (offset + bytesToRead - 1) / UFS_BLOCK_SIZE;
+    size_t blockCount = lastBlock - firstBlock + 1;
+    super_t super;
+    this->readSuperBlock(&super);
+    FileBlockMap blockMap(this, &super, inode);
+    vector<int> blocksToRead;
+    blockMap.get(firstBlock, blockCount, blocksToRead);
+    vector<char> blockBuffer(blockCount * UFS_BLOCK_SIZE);
+    this->disk->readBlocks(blocksToRead.data(), blockCount, blockBuffer.data());
+    memcpy(buffer, blockBuffer.data() + offset % UFS_BLOCK_SIZE, bytesToRead);
+
+    return bytesToRead;
+}
+
+int LocalFileSystem::pwrite(int inodeNumber, const void* buffer, int size, int offset)
+{
+    super_t super;
+    this->readSuperBlock(&super);
+    if (size < 0 || offset < 0 || static_cast<long>(offset) + size > maxFileSize(&super)) {
+        return -EINVALIDSIZE;
+    }
+
+    // BEGIN TRANSACTION
+    this->beginTransaction();
+
+    inode_t inode;
+    if (this->readInodes(&inodeNumber, 1, &inode) != 0) {
+        this->rollbackTransaction();
+        return -EINVALIDINODE;
+    }
+    if (inodeType(inode) != UFS_REGULAR_FILE) {
+        this->rollbackTransaction();
+        return -EINVALIDTYPE;
+    }
+    if (size == 0) {
+        this->commitTransaction();
+        return 0;
+    }
+
+    // An empty file that stays small enough takes its data inline
+    size_t end = offset + size;
+    if (inode.size == 0 && !isInline(inode) && super.version >= UFS_VERSION_INLINE && end <= INLINE_DATA_MAX) {
+        memset(inode.direct, 0, sizeof(inode.direct));
+        inode.type |= UFS_INLINE_DATA;
+    }
+    if (isInline(inode)) {
+        if (end <= INLINE_DATA_MAX) {
+            memcpy(reinterpret_cast<char*>(inode.direct) + offset, buffer, size);
+            inode.size = max(static_cast<size_t>(inode.size), end);
+            this->writeInode(inodeNumber, inode);
+            this->commitTransaction();
+            return size;
+        }
+
+        // Growing past the inode: move the data out to a block first
+        char data[INLINE_DATA_MAX];
+        memcpy(data, inode.direct, inode.size);
+        inode.type = inodeType(inode);
+        if (writeData(this, &super, inode, data, inode.size, 0) < 0) {
+            this->rollbackTransaction();
+            return -ENOTENOUGHSPACE;
+        }
+    }
+
+    // Grow the file first. New blocks, including any skipped over between
+    // the old end and offset, are allocated zeroed.
+    size_t allocatedBlocks = std::ceil(static_cast<double>(inode.size) / UFS_BLOCK_SIZE);
+    size_t blocksNeeded = std::ceil(static_cast<double>(end) / UFS_BLOCK_SIZE);
+    if (allocatedBlocks == 0) {
+        for (int j = 0; j < DIRECT_PTRS; j++) {
+            inode.direct[j] = UINT_MAX;
+        }
+    }
+    FileBlockMap blockMap(this, &super, inode);
+    if (blocksNeeded > allocatedBlocks &&
+        allocateFileBlocks(this, blockMap, allocatedBlocks, blocksNeeded) != blocksNeeded - allocatedBlocks) {
+        this->rollbackTransaction();
+        return -ENOTENOUGHSPACE;
+    }
+    blockMap.flush();
+
+    // Only a partially overwritten first or last block that already held
+    // data has to be read before it is written back
+    size_t firstBlock = offset / UFS_BLOCK_SIZE;
+    size_t lastBlock = (end - 1) / UFS_BLOCK_SIZE;
+    size_t blockCount = lastBlock - firstBlock + 1;
+    vector<int> blocksToWrite;
+    blockMap.get(firstBlock, blockCount, blocksToWrite);
+    vector<char> blockBuffer(blockCount * UFS_BLOCK_SIZE, 0);
+    if (offset % UFS_BLOCK_SIZE != 0 && firstBlock < allocatedBlocks) {
+        this->disk->readBlock(blocksToWrite.front(), blockBuffer.data());
+    }
+    if (end % UFS_BLOCK_SIZE != 0 && lastBlock < allocatedBlocks && (lastBlock != firstBlock || offset % UFS_BLOCK_SIZE == 0)) {
+        this->disk->readBlock(blocksToWrite.back(), blockBuffer.data() + (blockCount - 1) * UFS_BLOCK_SIZE);
+    }
+    memcpy(blockBuffer.data() + offset % UFS_BLOCK_SIZE, buffer, size);
+    this->disk->writeBlocks(blocksToWrite.data(), blockCount, blockBuffer.data());
+
+    // Only a write past the end changes the inode
+    if (end > static_cast<size_t>(inode.size)) {
+        inode.size = end;
+        this->writeInode(inodeNumber, inode);
+    }
+
+    // COMMIT TRANSACTION
+    this->commitTransaction();
+
+    return size;
 }
 
 int LocalFileSystem::create(int parentInodeNumber, int type, string name)
 {
     // START TRANSACTION
-    this->disk->beginTransaction();
+    this->beginTransaction();
 
     super_t super;
     this->readSuperBlock(&super);
@@ -485,32 +1223,30 @@ int LocalFileSystem::create(int parentInodeNumber, int type, string name)
     // Validate parameters first
     int validationResult = validateCreateParameters(this, &super, parentInodeNumber, type, name);
     if (validationResult != 0) {
-        this->disk->rollback();
+        this->rollbackTransaction();
         return validationResult;
     }
 
-    int newInodeNum = allocateInode(this, &super);
+    int newInodeNum = this->allocateInode();
     if (newInodeNum < 0) {
         // ROLLBACK
-        this->disk->rollback();
+        this->rollbackTransaction();
         return newInodeNum;
     }
 
-    // Read in inodes from disk
-    vector<inode_t> inodes(super.num_inodes);
-    this->readInodeRegion(&super, inodes.data());
-
     // create new inode (file or directory)
+    inode_t newInode;
+    memset(&newInode, 0, sizeof(inode_t));
     if (type == UFS_REGULAR_FILE) {
-        inodes[newInodeNum].size = 0;
-        inodes[newInodeNum].type = UFS_REGULAR_FILE;
+        newInode.size = 0;
+        newInode.type = UFS_REGULAR_FILE;
         for (int i = 0; i < DIRECT_PTRS; i++) {
-            inodes[newInodeNum].direct[i] = UINT_MAX;
+            newInode.direct[i] = UINT_MAX;
         }
     } else {
         size_t newDirSize = sizeof(dir_ent_t) * 2;
-        inodes[newInodeNum].size = newDirSize;
-        inodes[newInodeNum].type = UFS_DIRECTORY;
+        newInode.size = newDirSize;
+        newInode.type = UFS_DIRECTORY;
 
         // Initialize directory with . and .. entries
         dir_ent_t* entries = new dir_ent_t[2];
@@ -520,71 +1256,86 @@ int LocalFileSystem::create(int parentInodeNumber, int type, string name)
         strcpy(entries[1].name, "..");
 
         // allocate data block for new directory
-        int bytesWritten = writeData(this, &super, inodes[newInodeNum], (char*)entries, newDirSize, 0);
+        int bytesWritten = writeData(this, &super, newInode, (char*)entries, newDirSize, 0);
         delete[] entries;
 
         if (bytesWritten < 0) {
-            this->disk->rollback();
+            this->rollbackTransaction();
             return bytesWritten;
         }
     }
 
+    this->writeInode(newInodeNum, newInode);
+
     // update parent directory (size and data)
-    int bytesWritten = addDirectoryEntry(this, &super, inodes, parentInodeNumber, newInodeNum, name);
+    int bytesWritten = addDirectoryEntry(this, &super, parentInodeNumber, newInodeNum, name);
     if (bytesWritten < 0) {
-        this->disk->rollback();
+        this->rollbackTransaction();
         return bytesWritten;
     }
+    this->directoryChanges[parentInodeNumber].push_back(make_pair(name, newInodeNum));
 
     // COMMIT
-    this->writeInodeRegion(&super, inodes.data());
-    this->disk->commit();
+    this->commitTransaction();
 
     return newInodeNum;
 }
 
 int LocalFileSystem::write(int inodeNumber, const void* buffer, int size)
 {
-    // validate size
-    if (size < 0 || size >= DIRECT_PTRS * UFS_BLOCK_SIZE) {
+    super_t super;
+    this->readSuperBlock(&super);
+
+    // validate size, with the same bound as pwrite at offset 0
+    if (size < 0 || size > maxFileSize(&super)) {
         return -EINVALIDSIZE;
     }
 
     // BEGIN TRANSACTION
-    this->disk->beginTransaction();
+    this->beginTransaction();
 
     // find inode
     inode_t inode;
-    if (this->stat(inodeNumber, &inode) != 0) {
-        this->disk->rollback();
+    if (this->readInodes(&inodeNumber, 1, &inode) != 0) {
+        this->rollbackTransaction();
         return -EINVALIDINODE;
     }
 
-    if (inode.type != UFS_REGULAR_FILE) {
-        this->disk->rollback();
+    if (inodeType(inode) != UFS_REGULAR_FILE) {
+        this->rollbackTransaction();
         return -EINVALIDTYPE;
     }
 
-    super_t super;
-    this->readSuperBlock(&super);
-
-    // write buffer data to blocks
-    size_t oldSize = inode.size;
-    int bytesWritten = writeData(this, &super, inode, (char*)buffer, size, oldSize);
+    // Inline data has no blocks to reuse or free
+    size_t oldSize = isInline(inode) ? 0 : inode.size;
+    inode.type = UFS_REGULAR_FILE;
+
+    int bytesWritten;
+    if (size > 0 && static_cast<size_t>(size) <= INLINE_DATA_MAX && super.version >= UFS_VERSION_INLINE) {
+        // Small enough to keep in the inode: free any blocks the file had
+        // and write no data blocks at all
+        bytesWritten = writeData(this, &super, inode, NULL, 0, oldSize);
+        if (bytesWritten >= 0) {
+            memset(inode.direct, 0, sizeof(inode.direct));
+            memcpy(inode.direct, buffer, size);
+            inode.type |= UFS_INLINE_DATA;
+            bytesWritten = size;
+        }
+    } else {
+        // write buffer data to blocks
+        bytesWritten = writeData(this, &super, inode, (char*)buffer, size, oldSize);
+    }
     if (bytesWritten < 0) {
-        this->disk->rollback();
+        this->rollbackTransaction();
         return bytesWritten;
     }
 
-    // update inode in disk (read and write inode region)
+    // update inode, written with the commit
     inode.size = bytesWritten;
-    vector<inode_t> inodes(super.num_inodes);
-    this->readInodeRegion(&super, inodes.data());
-    inodes.at(inodeNumber) = inode;
-    this->writeInodeRegion(&super, inodes.data());
+    this->writeInode(inodeNumber, inode);
 
     // COMMIT TRANSACTION
-    this->disk->commit();
+    this->commitTransaction();
 
     return bytesWritten;
 }
@@ -597,76 +1348,69 @@ int LocalFileSystem::unlink(int parentInodeNumber, std::string name)
     }
 
     // Begin transaction
-    this->disk->beginTransaction();
+    this->beginTransaction();
 
     // Check if entry exists in parent directory
     int inodeToDelete = this->lookup(parentInodeNumber, name);
     if (inodeToDelete == -EINVALIDINODE) {
-        this->disk->rollback();
+        this->rollbackTransaction();
         return -EINVALIDINODE;
     } else if (inodeToDelete == -ENOTFOUND) {
-        this->disk->commit();
+        this->commitTransaction();
         return -ENOTFOUND;
     }
 
     super_t super;
     this->readSuperBlock(&super);
 
-    // Read inode region
-    vector<inode_t> inodes(super.num_inodes);
-    this->readInodeRegion(&super, inodes.data());
+    inode_t inode;
+    this->readInodes(&inodeToDelete, 1, &inode);
 
     // Handle directory deletion
     int ret;
-    if (inodes.at(inodeToDelete).type == UFS_DIRECTORY) {
+    if (inodeType(inode) == UFS_DIRECTORY) {
         // Check if directory is empty (except for . and ..)
-        if (inodes.at(inodeToDelete).size > static_cast<int>(sizeof(dir_ent_t) * 2)) {
-            this->disk->rollback();
+        if (inode.size > static_cast<int>(sizeof(dir_ent_t) * 2)) {
+            this->rollbackTransaction();
             return -EDIRNOTEMPTY;
         }
 
         // Remove . and .. entries
-        if ((ret = removeDirectoryEntry(this, &super, inodes, inodeToDelete, ".")) < 0) {
-            this->disk->rollback();
+        if ((ret = removeDirectoryEntry(this, &super, inodeToDelete, ".")) < 0) {
+            this->rollbackTransaction();
             return ret;
         }
 
-        if ((ret = removeDirectoryEntry(this, &super, inodes, inodeToDelete, "..")) < 0) {
-            this->disk->rollback();
+        if ((ret = removeDirectoryEntry(this, &super, inodeToDelete, "..")) < 0) {
+            this->rollbackTransaction();
             return ret;
         }
     }
 
     // Remove the entry from the parent directory
-    if ((ret = removeDirectoryEntry(this, &super, inodes, parentInodeNumber, name)) < 0) {
-        this->disk->rollback();
+    if ((ret = removeDirectoryEntry(this, &super, parentInodeNumber, name)) < 0) {
+        this->rollbackTransaction();
         return ret;
     }
-
-    // Deallocate data blocks of the inode being deleted
-    if (inodes.at(inodeToDelete).size > 0) {
-        for (int i = 0; i < DIRECT_PTRS; i++) {
-            if (inodes.at(inodeToDelete).direct[i] != UINT_MAX) {
-                if (deallocateDataBlock(this, &super, inodes.at(inodeToDelete).direct[i]) != 0) {
-                    this->disk->rollback();
-                    return -EUNLINKNOTALLOWED;
-                }
-                inodes.at(inodeToDelete).direct[i] = UINT_MAX;
-            }
+    this->directoryChanges[parentInodeNumber].push_back(make_pair(name, -ENOTFOUND));
+
+    // Deallocate data blocks of the inode being deleted (a directory's
+    // went when its . and .. entries were removed, and inline data has none)
+    this->readInodes(&inodeToDelete, 1, &inode);
+    if (inode.size > 0 && !isInline(inode)) {
+        FileBlockMap blockMap(this, &super, inode);
+        if (blockMap.truncate(0, std::ceil(static_cast<double>(inode.size) / UFS_BLOCK_SIZE)) != 0) {
+            this->rollbackTransaction();
+            return -EUNLINKNOTALLOWED;
         }
     }
 
     // Deallocate the inode bitmap entry
-    if (deallocateInode(this, &super, inodeToDelete) != 0) {
-        this->disk->rollback();
-        return -EUNLINKNOTALLOWED;
-    }
-
-    // Write the updated inodes to disk
-    this->writeInodeRegion(&super, inodes.data());
+    this->freeInode(inodeToDelete);
+    this->writeInode(inodeToDelete, inode);
 
     // Commit the transaction
-    this->disk->commit();
+    this->commitTransaction();
     return 0;
 }
 
@@ -0,0 +1,165 @@
+#include <cstring>
+#include <iostream>
+
+#include "FileDisk.h"
+#include "RamDisk.h"
+
+using namespace std;
+
+// Blocks loaded from or dumped to the image file per request
+#define RAMDISK_LOAD_BLOCKS (256)
+
+RamDisk::RamDisk(string imageFile, int blockSize, bool dumpOnClose) {
+  this->imageFile = imageFile;
+  this->blockSize = blockSize;
+  this->dumpOnClose = dumpOnClose;
+  this->isInTransaction = false;
+  pthread_mutex_init(&this->imageLock, NULL);
+  pthread_mutex_init(&this->transactionLock, NULL);
+
+  FileDisk source(imageFile, blockSize);
+  source.setCacheCapacity(0);
+  this->totalBlocks = source.numberOfBlocks();
+  this->image.resize((size_t) this->totalBlocks * this->blockSize);
+
+  int blockNumbers[RAMDISK_LOAD_BLOCKS];
+  for (int first = 0; first < this->totalBlocks; first += RAMDISK_LOAD_BLOCKS) {
+    int count = min(RAMDISK_LOAD_BLOCKS, this->totalBlocks - first);
+    for (int i = 0; i < count; i++) {
+      blockNumbers[i] = first + i;
+    }
+    source.readBlocks(blockNumbers, count, this->image.data() + (size_t) first * this->blockSize);
+  }
+}
+
+RamDisk::~RamDisk() {
+  if (isInTransaction) {
+    rollback();
+  }
+  if (this->dumpOnClose) {
+    dump();
+  }
+  pthread_mutex_destroy(&this->imageLock);
+  pthread_mutex_destroy(&this->transactionLock);
+}
+
+void RamDisk::dump() {
+  pthread_mutex_lock(&this->imageLock);
+  if (!this->dirty.empty()) {
+    // One FileDisk transaction. It only survives a crash as a whole if the
+    // image has a journal with room for every changed block (see
+    // FileDisk::commit); otherwise the blocks are written in place and a
+    // crash part way through can leave the file with some of them.
+    FileDisk target(this->imageFile, this->blockSize);
+    target.setCacheCapacity(0);
+    target.beginTransaction();
+    vector<int> blockNumbers(this->dirty.begin(), this->dirty.end());
+    for (size_t i = 0; i < blockNumbers.size(); i++) {
+      target.writeBlock(blockNumbers[i], this->image.data() + (size_t) blockNumbers[i] * this->blockSize);
+    }
+    target.commit();
+    this->dirty.clear();
+  }
+  pthread_mutex_unlock(&this->imageLock);
+}
+
+int RamDisk::numberOfBlocks() {
+  return this->totalBlocks;
+}
+
+bool RamDisk::inOwnTransaction() {
+  return isInTransaction && pthread_equal(this->transactionOwner, pthread_self());
+}
+
+void RamDisk::checkBlockNumber(int blockNumber) {
+  if (blockNumber < 0 || blockNumber >= this->totalBlocks) {
+    cerr << "Invalid block number " << blockNumber << endl;
+    exit(1);
+  }
+}
+
+void RamDisk::readBlocks(const int *blockNumbers, int count, void *buffer) {
+  unsigned char *destination = (unsigned char *) buffer;
+  bool ownTransaction = inOwnTransaction();
+  pthread_mutex_lock(&this->imageLock);
+  for (int i = 0; i < count; i++) {
+    checkBlockNumber(blockNumbers[i]);
+    const unsigned char *source = this->image.data() + (size_t) blockNumbers[i] * this->blockSize;
+    if (ownTransaction) {
+      map<int, vector<unsigned char> >::iterator iter = pending.find(blockNumbers[i]);
+      if (iter != pending.end()) {
+        source = iter->second.data();
+      }
+    }
+    memcpy(destination + (size_t) i * this->blockSize, source, this->blockSize);
+  }
+  pthread_mutex_unlock(&this->imageLock);
+  this->diskStats.blocksRead += count;
+  this->diskStats.bytesRead += (unsigned long) count * this->blockSize;
+}
+
+void RamDisk::writeBlocks(const int *blockNumbers, int count, const void *buffer) {
+  for (int i = 0; i < count; i++) {
+    checkBlockNumber(blockNumbers[i]);
+  }
+
+  // A write outside of a transaction is a transaction of its own
+  if (!inOwnTransaction()) {
+    beginTransaction();
+    writeBlocks(blockNumbers, count, buffer);
+    commit();
+    return;
+  }
+
+  const unsigned char *data = (const unsigned char *) buffer;
+  for (int i = 0; i < count; i++) {
+    const unsigned char *source = data + (size_t) i * this->blockSize;
+    pending[blockNumbers[i]].assign(source, source + this->blockSize);
+  }
+}
+
+void RamDisk::discardBlock(int blockNumber) {
+  checkBlockNumber(blockNumber);
+  if (!inOwnTransaction()) {
+    beginTransaction();
+    discardBlock(blockNumber);
+    commit();
+    return;
+  }
+  pending[blockNumber].assign(this->blockSize, 0);
+  this->diskStats.discards++;
+}
+
+void RamDisk::beginTransaction() {
+  if (inOwnTransaction()) {
+    cerr << "You can't start a new transaction: one already exists" << endl;
+    exit(1);
+  }
+  // Transactions from other threads wait their turn
+  pthread_mutex_lock(&this->transactionLock);
+  this->transactionOwner = pthread_self();
+  isInTransaction = true;
+}
+
+void RamDisk::commit() {
+  isInTransaction = false;
+  pthread_mutex_lock(&this->imageLock);
+  map<int, vector<unsigned char> >::iterator iter;
+  for (iter = pending.begin(); iter != pending.end(); iter++) {
+    memcpy(this->image.data() + (size_t) iter->first * this->blockSize, iter->second.data(), this->blockSize);
+    this->dirty.insert(iter->first);
+  }
+  pthread_mutex_unlock(&this->imageLock);
+  this->diskStats.blocksWritten += pending.size();
+  this->diskStats.bytesWritten += (unsigned long) pending.size() * this->blockSize;
+  this->diskStats.commits++;
+  pending.clear();
+  pthread_mutex_unlock(&this->transactionLock);
+}
+
+void RamDisk::rollback() {
+  isInTransaction = false;
+  this->diskStats.rollbacks++;
+  pending.clear();
+  pthread_mutex_unlock(&this->transactionLock);
+}
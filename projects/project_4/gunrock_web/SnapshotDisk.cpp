@@ -0,0 +1,468 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "FileDisk.h"
+#include "SnapshotDisk.h"
+#include "ufs.h"
+
+using namespace std;
+
+// Journal given to every overlay, in blocks, same as mkfs's default
+#define OVERLAY_JOURNAL_BLOCKS (128)
+
+#define STRIPE_PREFIX "stripe:"
+
+// Prefixes that pick how an image is opened rather than which file it is
+static const char *modePrefixes[] = {"cow:", "ram:", "ramdump:", "mmap:", "uring:", "direct:"};
+
+// Split a Disk::open spec into its mode prefixes and the image file
+static string splitImageSpec(string spec, string *prefixes) {
+  bool stripped = true;
+  while (stripped) {
+    stripped = false;
+    for (size_t i = 0; i < sizeof(modePrefixes) / sizeof(modePrefixes[0]); i++) {
+      size_t length = strlen(modePrefixes[i]);
+      if (spec.compare(0, length, modePrefixes[i]) == 0) {
+        *prefixes += modePrefixes[i];
+        spec = spec.substr(length);
+        stripped = true;
+      }
+    }
+  }
+  return spec;
+}
+
+// FNV-1a, continuing from hash
+static unsigned int fnv1a(unsigned int hash, const void *data, size_t length) {
+  const unsigned char *bytes = (const unsigned char *) data;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Record what the base image named by baseImage, open as base, looks like
+// now in the base_* fields of super. The files of a striped base are
+// folded into the hash, one after another.
+static void identifyBase(string baseImage, Disk *base, overlay_super_t *super) {
+  vector<unsigned char> block(UFS_BLOCK_SIZE);
+  base->readBlock(0, block.data());
+  unsigned int hash = fnv1a(2166136261u, block.data(), block.size());
+
+  string prefixes;
+  string path = splitImageSpec(baseImage, &prefixes);
+  vector<string> files(1, path);
+  if (path.compare(0, strlen(STRIPE_PREFIX), STRIPE_PREFIX) == 0) {
+    files.clear();
+    stringstream members(path.substr(strlen(STRIPE_PREFIX)));
+    string member;
+    while (getline(members, member, ',')) {
+      string memberPrefixes;
+      files.push_back(splitImageSpec(member, &memberPrefixes));
+    }
+  }
+
+  super->base_size = 0;
+  super->base_mtime_sec = 0;
+  super->base_mtime_nsec = 0;
+  super->base_ino = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    struct stat stat;
+    if (::stat(files[i].c_str(), &stat) != 0 || !S_ISREG(stat.st_mode)) {
+      continue;
+    }
+    if (files.size() == 1) {
+      super->base_size = stat.st_size;
+      super->base_mtime_sec = stat.st_mtim.tv_sec;
+      super->base_mtime_nsec = stat.st_mtim.tv_nsec;
+      super->base_ino = stat.st_ino;
+    } else {
+      long long identity[] = {(long long) stat.st_size, (long long) stat.st_mtim.tv_sec,
+                              (long long) stat.st_mtim.tv_nsec, (long long) stat.st_ino};
+      hash = fnv1a(hash, identity, sizeof(identity));
+    }
+  }
+  super->base_checksum = hash;
+}
+
+int SnapshotDisk::create(string baseImage, string overlayFile, int blockSize) {
+  if (blockSize != UFS_BLOCK_SIZE) {
+    cerr << "Overlays need " << UFS_BLOCK_SIZE << " byte blocks" << endl;
+    return -1;
+  }
+
+  // Opening and closing the base checkpoints its journal, so what gets
+  // frozen is the image with every committed transaction in place
+  Disk *base = Disk::open(baseImage, blockSize);
+  int numBlocks = base->numberOfBlocks();
+  delete base;
+  base = NULL;
+
+  // The overlay names its base by absolute path so it can be opened from
+  // anywhere. Striped bases are kept as given and are not write protected.
+  string prefixes;
+  string path = splitImageSpec(baseImage, &prefixes);
+  char resolved[PATH_MAX];
+  struct stat stat;
+  if (::stat(path.c_str(), &stat) == 0 && S_ISREG(stat.st_mode) && realpath(path.c_str(), resolved) != NULL) {
+    if (chmod(resolved, stat.st_mode & ~(S_IWUSR | S_IWGRP | S_IWOTH)) != 0) {
+      perror(resolved);
+      return -1;
+    }
+    baseImage = prefixes + resolved;
+  }
+  if (baseImage.size() >= OVERLAY_BASE_MAX) {
+    cerr << "Base image name is too long: " << baseImage << endl;
+    return -1;
+  }
+
+  int intsPerBlock = blockSize / sizeof(int);
+  int tableLength = (numBlocks + intsPerBlock - 1) / intsPerBlock;
+  int totalBlocks = 1 + tableLength + numBlocks + OVERLAY_JOURNAL_BLOCKS + 1;
+
+  int fd = ::open(overlayFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    perror(overlayFile.c_str());
+    return -1;
+  }
+
+  vector<unsigned char> block(blockSize, 0);
+  overlay_super_t *super = (overlay_super_t *) block.data();
+  super->magic = UFS_OVERLAY_MAGIC;
+  super->num_blocks = numBlocks;
+  super->table_len = tableLength;
+  super->num_mapped = 0;
+  super->journal_addr = 1 + tableLength + numBlocks;
+  super->journal_len = OVERLAY_JOURNAL_BLOCKS;
+  strcpy(super->base, baseImage.c_str());
+  base = Disk::open(baseImage, blockSize);
+  identifyBase(baseImage, base, super);
+  delete base;
+
+  int returnCode = 0;
+  if (ftruncate(fd, (off_t) totalBlocks * blockSize) != 0 ||
+      pwrite(fd, block.data(), blockSize, 0) != blockSize) {
+    perror(overlayFile.c_str());
+    returnCode = -1;
+  }
+
+  memset(block.data(), 0, blockSize);
+  journal_super_t *journalSuper = (journal_super_t *) block.data();
+  journalSuper->magic = UFS_JOURNAL_MAGIC;
+  journalSuper->journal_len = OVERLAY_JOURNAL_BLOCKS;
+  journalSuper->checkpoint_seq = 0;
+  if (returnCode == 0 &&
+      (pwrite(fd, block.data(), blockSize, (off_t) (totalBlocks - 1) * blockSize) != blockSize ||
+       fsync(fd) != 0)) {
+    perror(overlayFile.c_str());
+    returnCode = -1;
+  }
+  close(fd);
+  return returnCode;
+}
+
+SnapshotDisk::SnapshotDisk(string overlayFile, int blockSize) {
+  this->blockSize = blockSize;
+  this->isInTransaction = false;
+  pthread_mutex_init(&this->remapLock, NULL);
+  pthread_mutex_init(&this->transactionLock, NULL);
+
+  this->overlay = new FileDisk(overlayFile, blockSize);
+  overlay_super_t *super = &this->header;
+  if (blockSize != UFS_BLOCK_SIZE) {
+    cerr << overlayFile << " is not an overlay" << endl;
+    exit(1);
+  }
+  this->overlay->readBlock(0, super);
+  if (super->magic != UFS_OVERLAY_MAGIC) {
+    cerr << overlayFile << " is not an overlay" << endl;
+    exit(1);
+  }
+  super->base[OVERLAY_BASE_MAX - 1] = '\0';
+  this->baseImage = super->base;
+  this->totalBlocks = super->num_blocks;
+  this->tableLength = super->table_len;
+  this->numMapped = super->num_mapped;
+  this->dataStart = 1 + this->tableLength;
+  if (this->dataStart + this->totalBlocks > this->overlay->numberOfBlocks() ||
+      this->numMapped < 0 || this->numMapped > this->totalBlocks) {
+    cerr << overlayFile << " is not an overlay" << endl;
+    exit(1);
+  }
+
+  // The base is only write protected by its mode, which root and tools
+  // that write it some other way can ignore, so make sure it is still
+  // the image the remap table was made against
+  this->base = Disk::open(this->baseImage, blockSize);
+  overlay_super_t current = *super;
+  identifyBase(this->baseImage, this->base, &current);
+  if (this->base->numberOfBlocks() != this->totalBlocks || current.base_checksum != super->base_checksum ||
+      current.base_size != super->base_size || current.base_mtime_sec != super->base_mtime_sec ||
+      current.base_mtime_nsec != super->base_mtime_nsec || current.base_ino != super->base_ino) {
+    cerr << this->baseImage << " changed after the snapshot in " << overlayFile << " was taken" << endl;
+    exit(1);
+  }
+
+  vector<int> tableBlocks;
+  for (int i = 0; i < this->tableLength; i++) {
+    tableBlocks.push_back(1 + i);
+  }
+  this->remap.resize((size_t) this->tableLength * blockSize / sizeof(int));
+  if (this->tableLength > 0) {
+    this->overlay->readBlocks(tableBlocks.data(), tableBlocks.size(), this->remap.data());
+  }
+}
+
+SnapshotDisk::~SnapshotDisk() {
+  if (isInTransaction) {
+    rollback();
+  }
+  delete this->overlay;
+  delete this->base;
+  pthread_mutex_destroy(&this->remapLock);
+  pthread_mutex_destroy(&this->transactionLock);
+}
+
+int SnapshotDisk::numberOfBlocks() {
+  return this->totalBlocks;
+}
+
+int SnapshotDisk::mappedBlocks() {
+  pthread_mutex_lock(&this->remapLock);
+  int mapped = this->numMapped;
+  pthread_mutex_unlock(&this->remapLock);
+  return mapped;
+}
+
+bool SnapshotDisk::inOwnTransaction() {
+  return isInTransaction && pthread_equal(this->transactionOwner, pthread_self());
+}
+
+void SnapshotDisk::checkBlockNumber(int blockNumber) {
+  if (blockNumber < 0 || blockNumber >= this->totalBlocks) {
+    cerr << "Invalid block number " << blockNumber << endl;
+    exit(1);
+  }
+}
+
+void SnapshotDisk::readBlocks(const int *blockNumbers, int count, void *buffer) {
+  unsigned char *destination = (unsigned char *) buffer;
+  bool ownTransaction = inOwnTransaction();
+
+  // Sort the blocks into those served by the overlay and by the base,
+  // then fetch each group with one request
+  vector<int> overlayBlocks, overlayPositions;
+  vector<int> baseBlocks, basePositions;
+  pthread_mutex_lock(&this->remapLock);
+  for (int i = 0; i < count; i++) {
+    checkBlockNumber(blockNumbers[i]);
+    unsigned char *slot = destination + (size_t) i * this->blockSize;
+    if (ownTransaction) {
+      map<int, vector<unsigned char> >::iterator iter = pending.find(blockNumbers[i]);
+      if (iter != pending.end()) {
+        memcpy(slot, iter->second.data(), this->blockSize);
+        continue;
+      }
+      if (discards.count(blockNumbers[i]) != 0) {
+        memset(slot, 0, this->blockSize);
+        continue;
+      }
+    }
+    int overlayBlock = this->remap[blockNumbers[i]];
+    if (overlayBlock != 0) {
+      overlayBlocks.push_back(overlayBlock);
+      overlayPositions.push_back(i);
+    } else {
+      baseBlocks.push_back(blockNumbers[i]);
+      basePositions.push_back(i);
+    }
+  }
+  pthread_mutex_unlock(&this->remapLock);
+
+  vector<unsigned char> data;
+  if (!overlayBlocks.empty()) {
+    data.resize(overlayBlocks.size() * this->blockSize);
+    this->overlay->readBlocks(overlayBlocks.data(), overlayBlocks.size(), data.data());
+    for (size_t i = 0; i < overlayBlocks.size(); i++) {
+      memcpy(destination + (size_t) overlayPositions[i] * this->blockSize,
+             data.data() + i * this->blockSize, this->blockSize);
+    }
+  }
+  if (!baseBlocks.empty()) {
+    data.resize(baseBlocks.size() * this->blockSize);
+    this->base->readBlocks(baseBlocks.data(), baseBlocks.size(), data.data());
+    for (size_t i = 0; i < baseBlocks.size(); i++) {
+      memcpy(destination + (size_t) basePositions[i] * this->blockSize,
+             data.data() + i * this->blockSize, this->blockSize);
+    }
+  }
+  this->diskStats.blocksRead += count;
+  this->diskStats.bytesRead += (unsigned long) count * this->blockSize;
+}
+
+void SnapshotDisk::writeBlocks(const int *blockNumbers, int count, const void *buffer) {
+  for (int i = 0; i < count; i++) {
+    checkBlockNumber(blockNumbers[i]);
+  }
+
+  // A write outside of a transaction is a transaction of its own
+  if (!inOwnTransaction()) {
+    beginTransaction();
+    writeBlocks(blockNumbers, count, buffer);
+    commit();
+    return;
+  }
+
+  const unsigned char *data = (const unsigned char *) buffer;
+  for (int i = 0; i < count; i++) {
+    const unsigned char *image = data + (size_t) i * this->blockSize;
+    pending[blockNumbers[i]].assign(image, image + this->blockSize);
+    discards.erase(blockNumbers[i]);
+  }
+}
+
+void SnapshotDisk::discardBlock(int blockNumber) {
+  checkBlockNumber(blockNumber);
+  if (!inOwnTransaction()) {
+    beginTransaction();
+    discardBlock(blockNumber);
+    commit();
+    return;
+  }
+  pending.erase(blockNumber);
+  discards.insert(blockNumber);
+}
+
+void SnapshotDisk::beginTransaction() {
+  if (inOwnTransaction()) {
+    cerr << "You can't start a new transaction: one already exists" << endl;
+    exit(1);
+  }
+  // Transactions from other threads wait their turn
+  pthread_mutex_lock(&this->transactionLock);
+  this->transactionOwner = pthread_self();
+  isInTransaction = true;
+}
+
+// Give a block its own overlay block if it does not have one yet. Only
+// commit() changes the remap table, so it can read it without remapLock.
+int SnapshotDisk::remapped(int blockNumber) {
+  int overlayBlock = this->remap[blockNumber];
+  if (overlayBlock == 0) {
+    map<int, int>::iterator iter = newlyMapped.find(blockNumber);
+    if (iter != newlyMapped.end()) {
+      return iter->second;
+    }
+    overlayBlock = this->dataStart + this->numMapped + newlyMapped.size();
+    newlyMapped[blockNumber] = overlayBlock;
+  }
+  return overlayBlock;
+}
+
+void SnapshotDisk::commit() {
+  isInTransaction = false;
+
+  // A discarded block is remapped too: the base still holds its old data
+  vector<int> overlayBlocks;
+  vector<unsigned char> data;
+  for (map<int, vector<unsigned char> >::iterator iter = pending.begin(); iter != pending.end(); iter++) {
+    overlayBlocks.push_back(remapped(iter->first));
+    data.insert(data.end(), iter->second.begin(), iter->second.end());
+  }
+  vector<int> overlayDiscards;
+  for (set<int>::iterator iter = discards.begin(); iter != discards.end(); iter++) {
+    overlayDiscards.push_back(remapped(*iter));
+  }
+
+  // The new table entries and the data go to the overlay atomically
+  int intsPerBlock = this->blockSize / sizeof(int);
+  set<int> tableBlocks;
+  for (map<int, int>::iterator iter = newlyMapped.begin(); iter != newlyMapped.end(); iter++) {
+    tableBlocks.insert(iter->first / intsPerBlock);
+  }
+  for (set<int>::iterator iter = tableBlocks.begin(); iter != tableBlocks.end(); iter++) {
+    vector<int> entries(this->remap.begin() + *iter * intsPerBlock,
+                        this->remap.begin() + (*iter + 1) * intsPerBlock);
+    for (int i = 0; i < intsPerBlock; i++) {
+      map<int, int>::iterator mapped = newlyMapped.find(*iter * intsPerBlock + i);
+      if (mapped != newlyMapped.end()) {
+        entries[i] = mapped->second;
+      }
+    }
+    overlayBlocks.push_back(1 + *iter);
+    data.insert(data.end(), (unsigned char *) entries.data(), (unsigned char *) (entries.data() + intsPerBlock));
+  }
+  overlay_super_t super = this->header;
+  if (!newlyMapped.empty()) {
+    super.num_mapped = this->numMapped + newlyMapped.size();
+    overlayBlocks.push_back(0);
+    data.insert(data.end(), (unsigned char *) &super, (unsigned char *) (&super + 1));
+  }
+
+  this->overlay->beginTransaction();
+  if (!overlayBlocks.empty()) {
+    this->overlay->writeBlocks(overlayBlocks.data(), overlayBlocks.size(), data.data());
+  }
+  for (size_t i = 0; i < overlayDiscards.size(); i++) {
+    this->overlay->discardBlock(overlayDiscards[i]);
+  }
+  this->overlay->commit();
+
+  pthread_mutex_lock(&this->remapLock);
+  for (map<int, int>::iterator iter = newlyMapped.begin(); iter != newlyMapped.end(); iter++) {
+    this->remap[iter->first] = iter->second;
+  }
+  this->numMapped += newlyMapped.size();
+  this->header = super;
+  pthread_mutex_unlock(&this->remapLock);
+
+  this->diskStats.blocksWritten += pending.size();
+  this->diskStats.bytesWritten += (unsigned long) pending.size() * this->blockSize;
+  this->diskStats.discards += discards.size();
+  this->diskStats.commits++;
+  newlyMapped.clear();
+  pending.clear();
+  discards.clear();
+  pthread_mutex_unlock(&this->transactionLock);
+}
+
+void SnapshotDisk::rollback() {
+  isInTransaction = false;
+  this->diskStats.rollbacks++;
+  pending.clear();
+  discards.clear();
+  pthread_mutex_unlock(&this->transactionLock);
+}
+
+unsigned long SnapshotDisk::syscallCount() {
+  return this->base->syscallCount() + this->overlay->syscallCount();
+}
+
+void SnapshotDisk::setGroupCommitWindow(int usec) {
+  this->overlay->setGroupCommitWindow(usec);
+}
+
+void SnapshotDisk::setCacheCapacity(int blocks) {
+  this->base->setCacheCapacity(blocks / 2);
+  this->overlay->setCacheCapacity(blocks - blocks / 2);
+}
+
+unsigned long SnapshotDisk::cacheHits() {
+  return this->base->cacheHits() + this->overlay->cacheHits();
+}
+
+unsigned long SnapshotDisk::cacheMisses() {
+  return this->base->cacheMisses() + this->overlay->cacheMisses();
+}
+
+unsigned long SnapshotDisk::cacheEvictions() {
+  return this->base->cacheEvictions() + this->overlay->cacheEvictions();
+}
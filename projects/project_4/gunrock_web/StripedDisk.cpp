@@ -0,0 +1,337 @@
+#include <cstring>
+#include <iostream>
+
+#include "StripedDisk.h"
+
+using namespace std;
+
+StripedDisk::StripedDisk(const vector<string>& members, int blockSize) {
+  if (members.empty()) {
+    cerr << "A striped disk needs at least one member image" << endl;
+    exit(1);
+  }
+  this->blockSize = blockSize;
+  this->isInTransaction = false;
+  pthread_mutex_init(&this->transactionLock, NULL);
+
+  // Every stripe holds the same number of blocks; extra blocks at the
+  // end of a longer member are not used
+  int stripeBlocks = -1;
+  for (size_t i = 0; i < members.size(); i++) {
+    Disk *disk = Disk::open(members[i], blockSize);
+    if (stripeBlocks < 0 || disk->numberOfBlocks() < stripeBlocks) {
+      stripeBlocks = disk->numberOfBlocks();
+    }
+    this->disks.push_back(disk);
+  }
+  this->totalBlocks = stripeBlocks * members.size();
+
+  for (size_t i = 0; i < members.size(); i++) {
+    Worker *worker = new Worker;
+    worker->owner = this;
+    worker->stripe = i;
+    worker->stopping = false;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->ready, NULL);
+    pthread_create(&worker->thread, NULL, workerMain, worker);
+    this->workers.push_back(worker);
+  }
+}
+
+StripedDisk::~StripedDisk() {
+  if (isInTransaction) {
+    rollback();
+  }
+  for (size_t i = 0; i < this->workers.size(); i++) {
+    Worker *worker = this->workers[i];
+    pthread_mutex_lock(&worker->lock);
+    worker->stopping = true;
+    pthread_cond_signal(&worker->ready);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->ready);
+    delete worker;
+  }
+  for (size_t i = 0; i < this->disks.size(); i++) {
+    delete this->disks[i];
+  }
+  pthread_mutex_destroy(&this->transactionLock);
+}
+
+// Each stripe's worker runs the tasks for its member in order. Member
+// transactions are always begun and committed on the worker, so the
+// member sees a single thread owning them.
+void *StripedDisk::workerMain(void *arg) {
+  Worker *worker = (Worker *) arg;
+  pthread_mutex_lock(&worker->lock);
+  while (true) {
+    while (worker->tasks.empty() && !worker->stopping) {
+      pthread_cond_wait(&worker->ready, &worker->lock);
+    }
+    if (worker->tasks.empty()) {
+      break;
+    }
+    pair<StripeTask *, StripeBatch *> next = worker->tasks.front();
+    worker->tasks.pop_front();
+    pthread_mutex_unlock(&worker->lock);
+
+    worker->owner->runTask(next.first);
+
+    StripeBatch *batch = next.second;
+    pthread_mutex_lock(&batch->lock);
+    batch->remaining--;
+    pthread_cond_signal(&batch->done);
+    pthread_mutex_unlock(&batch->lock);
+
+    pthread_mutex_lock(&worker->lock);
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return NULL;
+}
+
+void StripedDisk::runTask(StripeTask *task) {
+  Disk *disk = this->disks[task->stripe];
+  if (!task->commit) {
+    task->data.resize(task->blocks.size() * this->blockSize);
+    disk->readBlocks(task->blocks.data(), task->blocks.size(), task->data.data());
+    return;
+  }
+
+  disk->beginTransaction();
+  if (!task->blocks.empty()) {
+    disk->writeBlocks(task->blocks.data(), task->blocks.size(), task->data.data());
+  }
+  for (size_t i = 0; i < task->discards.size(); i++) {
+    disk->discardBlock(task->discards[i]);
+  }
+  disk->commit();
+}
+
+// Hand every task to its stripe's worker and wait for all of them
+void StripedDisk::runTasks(vector<StripeTask>& tasks) {
+  StripeBatch batch;
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.done, NULL);
+  batch.remaining = tasks.size();
+
+  for (size_t i = 0; i < tasks.size(); i++) {
+    Worker *worker = this->workers[tasks[i].stripe];
+    pthread_mutex_lock(&worker->lock);
+    worker->tasks.push_back(make_pair(&tasks[i], &batch));
+    pthread_cond_signal(&worker->ready);
+    pthread_mutex_unlock(&worker->lock);
+  }
+
+  pthread_mutex_lock(&batch.lock);
+  while (batch.remaining > 0) {
+    pthread_cond_wait(&batch.done, &batch.lock);
+  }
+  pthread_mutex_unlock(&batch.lock);
+  pthread_mutex_destroy(&batch.lock);
+  pthread_cond_destroy(&batch.done);
+}
+
+int StripedDisk::numberOfBlocks() {
+  return this->totalBlocks;
+}
+
+bool StripedDisk::inOwnTransaction() {
+  return isInTransaction && pthread_equal(this->transactionOwner, pthread_self());
+}
+
+void StripedDisk::checkBlockNumber(int blockNumber) {
+  if (blockNumber < 0 || blockNumber >= this->totalBlocks) {
+    cerr << "Invalid block number " << blockNumber << endl;
+    exit(1);
+  }
+}
+
+void StripedDisk::readBlocks(const int *blockNumbers, int count, void *buffer) {
+  unsigned char *destination = (unsigned char *) buffer;
+  int numStripes = this->disks.size();
+  bool ownTransaction = inOwnTransaction();
+
+  vector<int> taskForStripe(numStripes, -1);
+  vector<StripeTask> tasks;
+  for (int i = 0; i < count; i++) {
+    checkBlockNumber(blockNumbers[i]);
+    unsigned char *slot = destination + (size_t) i * this->blockSize;
+    if (ownTransaction) {
+      map<int, vector<unsigned char> >::iterator iter = pending.find(blockNumbers[i]);
+      if (iter != pending.end()) {
+        memcpy(slot, iter->second.data(), this->blockSize);
+        continue;
+      }
+      if (discards.count(blockNumbers[i]) != 0) {
+        memset(slot, 0, this->blockSize);
+        continue;
+      }
+    }
+
+    int stripe = blockNumbers[i] % numStripes;
+    if (taskForStripe[stripe] < 0) {
+      taskForStripe[stripe] = tasks.size();
+      StripeTask task;
+      task.stripe = stripe;
+      task.commit = false;
+      tasks.push_back(task);
+    }
+    StripeTask& task = tasks[taskForStripe[stripe]];
+    task.blocks.push_back(blockNumbers[i] / numStripes);
+    task.positions.push_back(i);
+  }
+
+  // A single stripe is read on this thread; more go out in parallel
+  if (tasks.size() == 1) {
+    runTask(&tasks[0]);
+  } else if (tasks.size() > 1) {
+    runTasks(tasks);
+  }
+
+  for (size_t t = 0; t < tasks.size(); t++) {
+    for (size_t i = 0; i < tasks[t].blocks.size(); i++) {
+      memcpy(destination + (size_t) tasks[t].positions[i] * this->blockSize,
+             tasks[t].data.data() + i * this->blockSize, this->blockSize);
+    }
+  }
+  this->diskStats.blocksRead += count;
+  this->diskStats.bytesRead += (unsigned long) count * this->blockSize;
+}
+
+void StripedDisk::writeBlocks(const int *blockNumbers, int count, const void *buffer) {
+  for (int i = 0; i < count; i++) {
+    checkBlockNumber(blockNumbers[i]);
+  }
+
+  // A write outside of a transaction is a transaction of its own
+  if (!inOwnTransaction()) {
+    beginTransaction();
+    writeBlocks(blockNumbers, count, buffer);
+    commit();
+    return;
+  }
+
+  const unsigned char *data = (const unsigned char *) buffer;
+  for (int i = 0; i < count; i++) {
+    const unsigned char *image = data + (size_t) i * this->blockSize;
+    pending[blockNumbers[i]].assign(image, image + this->blockSize);
+    discards.erase(blockNumbers[i]);
+  }
+}
+
+void StripedDisk::discardBlock(int blockNumber) {
+  checkBlockNumber(blockNumber);
+  if (!inOwnTransaction()) {
+    beginTransaction();
+    discardBlock(blockNumber);
+    commit();
+    return;
+  }
+  pending.erase(blockNumber);
+  discards.insert(blockNumber);
+}
+
+void StripedDisk::beginTransaction() {
+  if (inOwnTransaction()) {
+    cerr << "You can't start a new transaction: one already exists" << endl;
+    exit(1);
+  }
+  // Transactions from other threads wait their turn
+  pthread_mutex_lock(&this->transactionLock);
+  this->transactionOwner = pthread_self();
+  isInTransaction = true;
+}
+
+void StripedDisk::commit() {
+  isInTransaction = false;
+  int numStripes = this->disks.size();
+
+  vector<int> taskForStripe(numStripes, -1);
+  vector<StripeTask> tasks;
+  map<int, vector<unsigned char> >::iterator iter;
+  set<int>::iterator discard = discards.begin();
+  iter = pending.begin();
+  while (iter != pending.end() || discard != discards.end()) {
+    bool isWrite = discard == discards.end() || (iter != pending.end() && iter->first < *discard);
+    int blockNumber = isWrite ? iter->first : *discard;
+    int stripe = blockNumber % numStripes;
+    if (taskForStripe[stripe] < 0) {
+      taskForStripe[stripe] = tasks.size();
+      StripeTask task;
+      task.stripe = stripe;
+      task.commit = true;
+      tasks.push_back(task);
+    }
+    StripeTask& task = tasks[taskForStripe[stripe]];
+    if (isWrite) {
+      task.blocks.push_back(blockNumber / numStripes);
+      task.data.insert(task.data.end(), iter->second.begin(), iter->second.end());
+      iter++;
+    } else {
+      task.discards.push_back(blockNumber / numStripes);
+      discard++;
+    }
+  }
+
+  runTasks(tasks);
+  this->diskStats.blocksWritten += pending.size();
+  this->diskStats.bytesWritten += (unsigned long) pending.size() * this->blockSize;
+  this->diskStats.discards += discards.size();
+  this->diskStats.commits++;
+  pending.clear();
+  discards.clear();
+  pthread_mutex_unlock(&this->transactionLock);
+}
+
+void StripedDisk::rollback() {
+  isInTransaction = false;
+  this->diskStats.rollbacks++;
+  pending.clear();
+  discards.clear();
+  pthread_mutex_unlock(&this->transactionLock);
+}
+
+unsigned long StripedDisk::syscallCount() {
+  unsigned long total = 0;
+  for (size_t i = 0; i < this->disks.size(); i++) {
+    total += this->disks[i]->syscallCount();
+  }
+  return total;
+}
+
+void StripedDisk::setGroupCommitWindow(int usec) {
+  for (size_t i = 0; i < this->disks.size(); i++) {
+    this->disks[i]->setGroupCommitWindow(usec);
+  }
+}
+
+void StripedDisk::setCacheCapacity(int blocks) {
+  for (size_t i = 0; i < this->disks.size(); i++) {
+    this->disks[i]->setCacheCapacity(blocks / this->disks.size());
+  }
+}
+
+unsigned long StripedDisk::cacheHits() {
+  unsigned long total = 0;
+  for (size_t i = 0; i < this->disks.size(); i++) {
+    total += this->disks[i]->cacheHits();
+  }
+  return total;
+}
+
+unsigned long StripedDisk::cacheMisses() {
+  unsigned long total = 0;
+  for (size_t i = 0; i < this->disks.size(); i++) {
+    total += this->disks[i]->cacheMisses();
+  }
+  return total;
+}
+
+unsigned long StripedDisk::cacheEvictions() {
+  unsigned long total = 0;
+  for (size_t i = 0; i < this->disks.size(); i++) {
+    total += this->disks[i]->cacheEvictions();
+  }
+  return total;
+}
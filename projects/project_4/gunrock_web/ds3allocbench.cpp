@@ -0,0 +1,129 @@
+#include <bitset>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Bitmap.h"
+#include "Disk.h"
+#include "LocalFileSystem.h"
+#include "ufs.h"
+
+using namespace std;
+
+// Allocations timed at each fill level unless given on the command line
+#define ALLOC_BENCH_DEFAULT_OPS (10000)
+
+static const int fillPercents[] = {10, 50, 95};
+
+static double nowUsec()
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The allocator LocalFileSystem used before Bitmap: one std::bitset per
+// byte, always from bit 0. Kept here as the baseline.
+static int byteScanAllocate(vector<unsigned char>& bitmap, int totalBits)
+{
+    for (size_t i = 0; i < bitmap.size(); i++) {
+        bitset<8> bits(bitmap[i]);
+        if (bits.all()) {
+            continue;
+        }
+        for (int j = 0; j < 8; j++) {
+            int bitIndex = (i * 8) + j;
+            if (bitIndex >= totalBits) {
+                return -1;
+            }
+            if (!bits[j]) {
+                bitmap[i] |= (1 << j);
+                return bitIndex;
+            }
+        }
+    }
+    return -1;
+}
+
+// A data bitmap with fillPercent of its bits set at random, the same
+// pattern for every allocator
+static vector<unsigned char> agedBitmap(int numBits, int fillPercent)
+{
+    vector<unsigned char> bits((numBits + 7) / 8, 0);
+    unsigned int seed = 1;
+    for (int i = 0; i < numBits; i++) {
+        if ((int)(rand_r(&seed) % 100) < fillPercent) {
+            bits[i / 8] |= (1 << (i % 8));
+        }
+    }
+    return bits;
+}
+
+static void printResult(const string& name, int fillPercent, int ops, double elapsedUsec)
+{
+    cout << left << setw(12) << name
+         << right << setw(6) << fillPercent << "%"
+         << setw(10) << ops
+         << setw(14) << fixed << setprecision(1) << elapsedUsec * 1000 / (ops > 0 ? ops : 1) << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3) {
+        cerr << argv[0] << ": diskImageFile [allocations]" << endl;
+        cerr << "Times data block allocation on an aged copy of the image's data bitmap" << endl;
+        cerr << "at several fill levels. Nothing is written to the image. For example:" << endl;
+        cerr << "    $ ./mkfs -f big.img -d 1000000" << endl;
+        cerr << "    $ " << argv[0] << " big.img" << endl;
+        return 1;
+    }
+    int ops = argc > 2 ? atoi(argv[2]) : ALLOC_BENCH_DEFAULT_OPS;
+
+    Disk* disk = Disk::open(argv[1], UFS_BLOCK_SIZE);
+    LocalFileSystem* fileSystem = new LocalFileSystem(disk);
+    super_t super;
+    fileSystem->readSuperBlock(&super);
+
+    cout << super.num_data << " data blocks, " << super.data_bitmap_len << " bitmap blocks";
+#ifdef __AVX2__
+    cout << ", AVX2";
+#endif
+    cout << endl;
+    cout << left << setw(12) << "allocator"
+         << right << setw(7) << "fill"
+         << setw(10) << "allocs"
+         << setw(14) << "nsec/alloc" << endl;
+
+    for (size_t f = 0; f < sizeof(fillPercents) / sizeof(fillPercents[0]); f++) {
+        int fillPercent = fillPercents[f];
+        vector<unsigned char> aged = agedBitmap(super.num_data, fillPercent);
+        int freeBits = 0;
+        for (int i = 0; i < super.num_data; i++) {
+            freeBits += (aged[i / 8] & (1 << (i % 8))) == 0;
+        }
+        int count = min(ops, freeBits);
+
+        vector<unsigned char> bytes = aged;
+        double start = nowUsec();
+        for (int i = 0; i < count; i++) {
+            byteScanAllocate(bytes, super.num_data);
+        }
+        printResult("byte scan", fillPercent, count, nowUsec() - start);
+
+        for (int nextFit = 0; nextFit <= 1; nextFit++) {
+            Bitmap bitmap(nextFit);
+            bitmap.load(disk, super.data_bitmap_addr, super.data_bitmap_len, super.num_data);
+            bitmap.copyFrom(aged.data());
+            start = nowUsec();
+            for (int i = 0; i < count; i++) {
+                bitmap.allocate();
+            }
+            printResult(nextFit ? "next fit" : "first fit", fillPercent, count, nowUsec() - start);
+        }
+    }
+
+    delete fileSystem;
+    delete disk;
+    return 0;
+}
@@ -0,0 +1,268 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Disk.h"
+#include "LocalFileSystem.h"
+#include "ufs.h"
+
+using namespace std;
+
+// Size of the file written and read back by the write/read phases
+#define BENCH_FILE_SIZE (4 * UFS_BLOCK_SIZE)
+
+// Size of the files used to measure large-file read throughput: the
+// most whole blocks every inode version holds without indirect blocks
+// (see ds3sizebench for bigger files)
+#define BENCH_BIG_FILE_SIZE (DIRECT_PTRS_V2 * UFS_BLOCK_SIZE)
+
+// Size of the small objects put and got by the smallput/smallget phases,
+// small enough to be kept inline in a version 3 image's inodes
+#define BENCH_SMALL_FILE_SIZE (64)
+
+struct PhaseResult {
+    string name;
+    int ops;
+    unsigned long syscalls;
+    double elapsedUsec;
+};
+
+static double nowUsec()
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static string fileName(int i)
+{
+    return "bench" + to_string(i);
+}
+
+static string bigFileName(int i)
+{
+    return "big" + to_string(i);
+}
+
+static string smallFileName(int i)
+{
+    return "small" + to_string(i);
+}
+
+static void printResult(const PhaseResult& result)
+{
+    double ops = result.ops > 0 ? result.ops : 1;
+    cout << left << setw(8) << result.name
+         << right << setw(8) << result.ops
+         << setw(14) << fixed << setprecision(1) << result.syscalls / ops
+         << setw(14) << fixed << setprecision(1) << result.elapsedUsec / ops << endl;
+}
+
+static PhaseResult runPhase(Disk* const disk, const string& name, int ops, int (*op)(LocalFileSystem* const, int, vector<int>&), LocalFileSystem* const fs, vector<int>& inodes)
+{
+    PhaseResult result;
+    result.name = name;
+    result.ops = 0;
+    unsigned long startSyscalls = disk->syscallCount();
+    double start = nowUsec();
+    for (int i = 0; i < ops; i++) {
+        if (op(fs, i, inodes) < 0) {
+            cerr << name << " failed for " << fileName(i) << endl;
+            break;
+        }
+        result.ops++;
+    }
+    result.elapsedUsec = nowUsec() - start;
+    result.syscalls = disk->syscallCount() - startSyscalls;
+    return result;
+}
+
+static int createOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    int inodeNumber = fs->create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, fileName(i));
+    inodes.push_back(inodeNumber);
+    return inodeNumber;
+}
+
+static int writeOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    static char data[BENCH_FILE_SIZE];
+    memset(data, 'a' + (i % 26), sizeof(data));
+    return fs->write(inodes.at(i), data, sizeof(data));
+}
+
+static int statOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    inode_t inode;
+    return fs->stat(inodes.at(i), &inode);
+}
+
+static int lookupOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    return fs->lookup(UFS_ROOT_DIRECTORY_INODE_NUMBER, fileName(i));
+}
+
+static int readOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    static char data[BENCH_FILE_SIZE];
+    return fs->read(inodes.at(i), data, sizeof(data));
+}
+
+static int unlinkOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    return fs->unlink(UFS_ROOT_DIRECTORY_INODE_NUMBER, fileName(i));
+}
+
+static int smallPutOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    static char data[BENCH_SMALL_FILE_SIZE];
+    memset(data, 'a' + (i % 26), sizeof(data));
+    int inodeNumber = fs->create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, smallFileName(i));
+    if (inodeNumber < 0) {
+        return inodeNumber;
+    }
+    inodes.push_back(inodeNumber);
+    return fs->write(inodeNumber, data, sizeof(data));
+}
+
+static int smallGetOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    static char data[BENCH_SMALL_FILE_SIZE];
+    int inodeNumber = fs->lookup(UFS_ROOT_DIRECTORY_INODE_NUMBER, smallFileName(i));
+    if (inodeNumber < 0) {
+        return inodeNumber;
+    }
+    return fs->read(inodeNumber, data, sizeof(data));
+}
+
+static int bigWriteOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    static char data[BENCH_BIG_FILE_SIZE];
+    memset(data, 'A' + (i % 26), sizeof(data));
+    int inodeNumber = fs->create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, bigFileName(i));
+    if (inodeNumber < 0) {
+        return inodeNumber;
+    }
+    inodes.push_back(inodeNumber);
+    return fs->write(inodeNumber, data, sizeof(data));
+}
+
+static int bigReadOp(LocalFileSystem* const fs, int i, vector<int>& inodes)
+{
+    static char data[BENCH_BIG_FILE_SIZE];
+    return fs->read(inodes.at(i), data, sizeof(data));
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 4) {
+        cerr << argv[0] << ": diskImageFile [numFiles [cacheBlocks]]" << endl;
+        cerr << "Runs file system operations against a scratch image, for example:" << endl;
+        cerr << "    $ ./mkfs -f bench.img -i 512 -d 4096 -V 3" << endl;
+        cerr << "    $ " << argv[0] << " bench.img 100" << endl;
+        cerr << "Prefix the image with a Disk mode (ram:, mmap:, uring:, direct:) to compare them," << endl;
+        cerr << "and pass cacheBlocks 0 to send every block read to the image. The smallput and" << endl;
+        cerr << "smallget files are kept inline only in images made with -V 3." << endl;
+        return 1;
+    }
+
+    int numFiles = 20;
+    if (argc >= 3) {
+        try {
+            numFiles = stoi(argv[2]);
+        } catch (const exception& e) {
+            numFiles = -1;
+        }
+        if (numFiles <= 0) {
+            cerr << "numFiles must be a positive number" << endl;
+            return 1;
+        }
+    }
+
+    int cacheBlocks = DISK_DEFAULT_CACHE_BLOCKS;
+    if (argc == 4) {
+        try {
+            cacheBlocks = stoi(argv[3]);
+        } catch (const exception& e) {
+            cacheBlocks = -1;
+        }
+        if (cacheBlocks < 0) {
+            cerr << "cacheBlocks must not be negative" << endl;
+            return 1;
+        }
+    }
+
+    Disk* disk = Disk::open(argv[1], UFS_BLOCK_SIZE);
+    disk->setCacheCapacity(cacheBlocks);
+    LocalFileSystem* fileSystem = new LocalFileSystem(disk);
+    vector<int> inodes;
+
+    vector<PhaseResult> results;
+    unsigned long createBlocksWritten = disk->stats().blocksWritten;
+    results.push_back(runPhase(disk, "create", numFiles, createOp, fileSystem, inodes));
+    createBlocksWritten = disk->stats().blocksWritten - createBlocksWritten;
+    numFiles = results.back().ops;
+    results.push_back(runPhase(disk, "write", numFiles, writeOp, fileSystem, inodes));
+    results.push_back(runPhase(disk, "stat", numFiles, statOp, fileSystem, inodes));
+    results.push_back(runPhase(disk, "lookup", numFiles, lookupOp, fileSystem, inodes));
+    results.push_back(runPhase(disk, "read", numFiles, readOp, fileSystem, inodes));
+    unsigned long unlinkBlocksWritten = disk->stats().blocksWritten;
+    results.push_back(runPhase(disk, "unlink", numFiles, unlinkOp, fileSystem, inodes));
+    unlinkBlocksWritten = disk->stats().blocksWritten - unlinkBlocksWritten;
+
+    // Small objects: create and write, then look up and read, each one
+    vector<int> smallInodes;
+    unsigned long smallBlocksWritten = disk->stats().blocksWritten;
+    results.push_back(runPhase(disk, "smallput", numFiles, smallPutOp, fileSystem, smallInodes));
+    smallBlocksWritten = disk->stats().blocksWritten - smallBlocksWritten;
+    PhaseResult smallPut = results.back();
+    results.push_back(runPhase(disk, "smallget", smallInodes.size(), smallGetOp, fileSystem, smallInodes));
+    PhaseResult smallGet = results.back();
+    for (size_t i = 0; i < smallInodes.size(); i++) {
+        fileSystem->unlink(UFS_ROOT_DIRECTORY_INODE_NUMBER, smallFileName(i));
+    }
+
+    // Large-file reads start with an empty block cache, so they measure
+    // the image (or the stripes of a stripe: image)
+    vector<int> bigInodes;
+    results.push_back(runPhase(disk, "bigwrite", numFiles, bigWriteOp, fileSystem, bigInodes));
+    disk->setCacheCapacity(cacheBlocks);
+    results.push_back(runPhase(disk, "bigread", bigInodes.size(), bigReadOp, fileSystem, bigInodes));
+    PhaseResult bigRead = results.back();
+    for (size_t i = 0; i < bigInodes.size(); i++) {
+        fileSystem->unlink(UFS_ROOT_DIRECTORY_INODE_NUMBER, bigFileName(i));
+    }
+
+    cout << left << setw(8) << "op"
+         << right << setw(8) << "count"
+         << setw(14) << "syscalls/op"
+         << setw(14) << "usec/op" << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        printResult(results[i]);
+    }
+    cout << endl;
+    double seconds = bigRead.elapsedUsec / 1000000.0;
+    cout << "large-file reads: " << fixed << setprecision(1)
+         << (seconds > 0 ? bigRead.ops * (double) BENCH_BIG_FILE_SIZE / (1024 * 1024) / seconds : 0)
+         << " MB/s (" << bigRead.ops << " files of " << BENCH_BIG_FILE_SIZE / 1024 << " KB)" << endl;
+    super_t super;
+    fileSystem->readSuperBlock(&super);
+    cout << "small objects: " << fixed << setprecision(0)
+         << (smallPut.elapsedUsec > 0 ? smallPut.ops * 1000000.0 / smallPut.elapsedUsec : 0) << " puts/s, "
+         << (smallGet.elapsedUsec > 0 ? smallGet.ops * 1000000.0 / smallGet.elapsedUsec : 0) << " gets/s, "
+         << setprecision(1) << (double) smallBlocksWritten / (smallPut.ops > 0 ? smallPut.ops : 1) << " blocks written/put ("
+         << BENCH_SMALL_FILE_SIZE << " bytes, " << (super.version >= UFS_VERSION_INLINE ? "inline" : "in data blocks") << ")" << endl;
+    cout << "directory entries: " << fixed << setprecision(1)
+         << (double) createBlocksWritten / (numFiles > 0 ? numFiles : 1) << " blocks written/create, "
+         << (double) unlinkBlocksWritten / (numFiles > 0 ? numFiles : 1) << " blocks written/unlink ("
+         << numFiles << " files in one directory)" << endl;
+    cout << "block cache: " << disk->cacheHits() << " hits, " << disk->cacheMisses() << " misses, "
+         << disk->cacheEvictions() << " evictions" << endl;
+    cout << "superblock reads avoided: " << fileSystem->superBlockReadsAvoided() << endl;
+    cout << "inode reads avoided: " << fileSystem->inodeReadsAvoided() << endl;
+
+    delete fileSystem;
+    delete disk;
+    return 0;
+}
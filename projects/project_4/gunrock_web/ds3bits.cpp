@@ -4,8 +4,10 @@
 #include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -19,6 +21,11 @@ void printSuperBlockInfo(super_t *super)
     cout << "data_region_addr " << super->data_region_addr << endl;
     cout << "data_region_len " << super->data_region_len << endl;
     cout << "num_data " << super->num_data << endl;
+    // Only images newer than version 1 say which inode version they use
+    if (super->version >= UFS_VERSION_INDIRECT)
+    {
+        cout << "version " << super->version << endl;
+    }
     cout << endl;
 }
 
@@ -55,22 +62,104 @@ void processInodeBitMap(super_t *super, LocalFileSystem *fileSystem)
     delete[] inodeBitmap;
 }
 
+// How scattered file data and free space are: a file in one extent can
+// be read with a single request, and new files can only get one extent
+// if free space comes in long runs
+void processFragmentation(super_t *super, LocalFileSystem *fileSystem)
+{
+    int inodeBitmapBytes = static_cast<int>(ceil(super->num_inodes / 8.0));
+    vector<unsigned char> inodeBitmap(inodeBitmapBytes);
+    fileSystem->readInodeBitmap(super, inodeBitmap.data());
+
+    int files = 0;
+    int fragmentedFiles = 0;
+    long blocks = 0;
+    long extents = 0;
+    for (int inodeNumber = 0; inodeNumber < super->num_inodes; inodeNumber++)
+    {
+        inode_t inode;
+        if ((inodeBitmap[inodeNumber / 8] & (1 << (inodeNumber % 8))) == 0 ||
+            fileSystem->stat(inodeNumber, &inode) != 0 || inode.size == 0)
+        {
+            continue;
+        }
+        vector<int> dataBlocks;
+        fileSystem->fileBlocks(inodeNumber, dataBlocks);
+        int numBlocks = dataBlocks.size();
+        int fileExtents = 1;
+        for (int i = 1; i < numBlocks; i++)
+        {
+            if (dataBlocks[i] != dataBlocks[i - 1] + 1)
+            {
+                fileExtents++;
+            }
+        }
+        files++;
+        blocks += numBlocks;
+        extents += fileExtents;
+        if (fileExtents > 1)
+        {
+            fragmentedFiles++;
+        }
+    }
+
+    int dataBitmapBytes = static_cast<int>(ceil(super->num_data / 8.0));
+    vector<unsigned char> dataBitmap(dataBitmapBytes);
+    fileSystem->readDataBitmap(super, dataBitmap.data());
+    int freeBlocks = 0;
+    int freeExtents = 0;
+    int largestFreeExtent = 0;
+    int run = 0;
+    for (int i = 0; i < super->num_data; i++)
+    {
+        if (dataBitmap[i / 8] & (1 << (i % 8)))
+        {
+            run = 0;
+            continue;
+        }
+        freeBlocks++;
+        if (run++ == 0)
+        {
+            freeExtents++;
+        }
+        largestFreeExtent = max(largestFreeExtent, run);
+    }
+
+    cout << "Fragmentation" << endl;
+    cout << "files " << files << " blocks " << blocks << " extents " << extents << endl;
+    cout << "fragmented files " << fragmentedFiles << " ("
+         << fixed << setprecision(1) << (files > 0 ? 100.0 * fragmentedFiles / files : 0) << "%)" << endl;
+    cout << "extents per file " << (files > 0 ? (double)extents / files : 0) << endl;
+    cout << "free blocks " << freeBlocks << " extents " << freeExtents
+         << " largest " << largestFreeExtent << endl;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    bool fragmentation = argc == 3 && string(argv[1]) == "-f";
+    if (argc != 2 && !fragmentation)
     {
-        cerr << argv[0] << ": diskImageFile" << endl;
+        cerr << argv[0] << ": [-f] diskImageFile" << endl;
+        cerr << "  -f  report file and free space fragmentation instead of the bitmaps" << endl;
         return 1;
     }
 
     // Parse command line arguments
-    Disk *disk = new Disk(argv[1], UFS_BLOCK_SIZE);
+    Disk *disk = Disk::open(argv[argc - 1], UFS_BLOCK_SIZE);
     LocalFileSystem *fileSystem = new LocalFileSystem(disk);
 
     // Read in super block
     super_t superBlock;
     fileSystem->readSuperBlock(&superBlock);
 
+    if (fragmentation)
+    {
+        processFragmentation(&superBlock, fileSystem);
+        delete fileSystem;
+        delete disk;
+        return 0;
+    }
+
     // Process superblock info and bitmaps
     printSuperBlockInfo(&superBlock);
     processInodeBitMap(&superBlock, fileSystem);
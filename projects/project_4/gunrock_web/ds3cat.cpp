@@ -7,6 +7,7 @@
 #include <iostream>
 #include <string>
 #include <unistd.h>
+#include <vector>
 
 using namespace std;
 
@@ -15,15 +16,22 @@ void printError()
     cerr << "Error reading file" << endl;
 }
 
-void printFileBlocks(inode_t* const inode)
+void printFileBlocks(const vector<int>& dataBlocks, const vector<int>& indirectBlocks)
 {
-    // writes File Blocks to STDOUT
+    // writes File Blocks to STDOUT, then the indirect blocks of a file
+    // too big for its direct pointers
     cout << "File blocks" << endl;
-    size_t blocksNeeded = std::ceil(static_cast<double>(inode->size) / UFS_BLOCK_SIZE);
-    for (size_t i = 0; i < blocksNeeded; i++) {
-        cout << inode->direct[i] << endl;
+    for (size_t i = 0; i < dataBlocks.size(); i++) {
+        cout << dataBlocks[i] << endl;
     }
     cout << endl;
+    if (!indirectBlocks.empty()) {
+        cout << "Indirect blocks" << endl;
+        for (size_t i = 0; i < indirectBlocks.size(); i++) {
+            cout << indirectBlocks[i] << endl;
+        }
+        cout << endl;
+    }
 }
 
 int printFileData(char* buffer, size_t fileSize)
@@ -53,14 +61,19 @@ int printFileContents(LocalFileSystem* const fileSystem, const int inodeNumber)
 
     // reads file contents from disk
     size_t fileSize = inode.size;
-    char buffer[fileSize];
-    if (fileSystem->read(inodeNumber, buffer, fileSize) < 0) {
+    vector<char> buffer(fileSize);
+    if (fileSystem->read(inodeNumber, buffer.data(), fileSize) < 0) {
+        return 1;
+    }
+    vector<int> dataBlocks;
+    vector<int> indirectBlocks;
+    if (fileSystem->fileBlocks(inodeNumber, dataBlocks, &indirectBlocks) != 0) {
         return 1;
     }
 
     // print to STDOUT
-    printFileBlocks(&inode);
-    if (printFileData(buffer, fileSize) == 1) {
+    printFileBlocks(dataBlocks, indirectBlocks);
+    if (printFileData(buffer.data(), fileSize) == 1) {
         return 1;
     }
 
@@ -75,7 +88,7 @@ int main(int argc, char* argv[])
     }
 
     // Parse command line arguments
-    Disk* disk = new Disk(argv[1], UFS_BLOCK_SIZE);
+    Disk* disk = Disk::open(argv[1], UFS_BLOCK_SIZE);
     LocalFileSystem* fileSystem = new LocalFileSystem(disk);
     int inodeNumber = stoi(argv[2]);
 
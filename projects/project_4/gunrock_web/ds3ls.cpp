@@ -117,7 +117,7 @@ int navigateToDirectory(LocalFileSystem* const fileSystem, const vector<string>&
     // Navigate through path
     size_t currentInode = 0;
     for (size_t i = 0; i < pathComponents.size(); i++) {
-        size_t nextInode = fileSystem->lookup(currentInode, pathComponents[i]);
+        int nextInode = fileSystem->lookup(currentInode, pathComponents[i]);
         if (nextInode == -EINVALIDINODE || nextInode == -ENOTFOUND) {
             return 1;
         }
@@ -175,7 +175,7 @@ int main(int argc, char* argv[])
     }
 
     // Parse command line arguments
-    Disk* disk = new Disk(argv[1], UFS_BLOCK_SIZE);
+    Disk* disk = Disk::open(argv[1], UFS_BLOCK_SIZE);
     LocalFileSystem* fileSystem = new LocalFileSystem(disk);
     string directory = string(argv[2]);
 
@@ -0,0 +1,131 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Disk.h"
+#include "LocalFileSystem.h"
+#include "ufs.h"
+
+using namespace std;
+
+static const int defaultSizesMB[] = {1, 16, 256};
+
+static double nowUsec()
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double megabytesPerSecond(size_t bytes, double usec)
+{
+    return usec > 0 ? bytes / (1024.0 * 1024.0) / (usec / 1000000.0) : 0;
+}
+
+// Write, read back and tail-read one file of sizeMB megabytes, then
+// remove it. Returns false if the image has no room for it.
+static bool runSize(Disk* const disk, LocalFileSystem* const fs, int sizeMB)
+{
+    size_t size = (size_t)sizeMB * 1024 * 1024;
+    size_t blocks = size / UFS_BLOCK_SIZE;
+    string name = "size" + to_string(sizeMB);
+    vector<char> data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = 'a' + (i / UFS_BLOCK_SIZE) % 26;
+    }
+
+    int inodeNumber = fs->create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, name);
+    if (inodeNumber < 0) {
+        cerr << "Could not create " << name << endl;
+        return false;
+    }
+
+    const DiskStats& stats = disk->stats();
+    unsigned long blocksWritten = stats.blocksWritten;
+    double start = nowUsec();
+    int rc = fs->write(inodeNumber, data.data(), size);
+    double writeUsec = nowUsec() - start;
+    blocksWritten = stats.blocksWritten - blocksWritten;
+    if (rc != (int)size) {
+        cerr << "Could not write " << sizeMB << " MB (" << rc << "), make the image bigger" << endl;
+        fs->unlink(UFS_ROOT_DIRECTORY_INODE_NUMBER, name);
+        return false;
+    }
+
+    unsigned long blocksRead = stats.blocksRead;
+    start = nowUsec();
+    fs->read(inodeNumber, data.data(), size);
+    double readUsec = nowUsec() - start;
+    blocksRead = stats.blocksRead - blocksRead;
+
+    // The last block alone, which is the furthest into the indirect blocks
+    unsigned long tailBlocksRead = stats.blocksRead;
+    fs->pread(inodeNumber, data.data(), UFS_BLOCK_SIZE, size - UFS_BLOCK_SIZE);
+    tailBlocksRead = stats.blocksRead - tailBlocksRead;
+
+    fs->unlink(UFS_ROOT_DIRECTORY_INODE_NUMBER, name);
+
+    cout << right << setw(6) << sizeMB << " MB"
+         << setw(9) << blocks
+         << fixed << setprecision(1)
+         << setw(11) << megabytesPerSecond(size, writeUsec)
+         << setw(11) << writeUsec / blocks
+         << setprecision(3) << setw(10) << (double)blocksWritten / blocks
+         << setprecision(1)
+         << setw(11) << megabytesPerSecond(size, readUsec)
+         << setw(11) << readUsec / blocks
+         << setprecision(3) << setw(10) << (double)blocksRead / blocks
+         << setw(8) << tailBlocksRead << endl;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        cerr << argv[0] << ": diskImageFile [sizeMB...]" << endl;
+        cerr << "Writes, reads back and removes one file of each size (1, 16 and 256 MB by" << endl;
+        cerr << "default) with the block cache off, and prints the cost per block. Files past" << endl;
+        cerr << "the direct blocks need an image made with indirect blocks, for example:" << endl;
+        cerr << "    $ ./mkfs -f size.img -i 64 -d 70000 -j 0 -V 2" << endl;
+        cerr << "    $ " << argv[0] << " ram:size.img" << endl;
+        return 1;
+    }
+
+    vector<int> sizesMB;
+    for (int i = 2; i < argc; i++) {
+        sizesMB.push_back(atoi(argv[i]));
+        if (sizesMB.back() <= 0) {
+            cerr << "sizes must be positive numbers of MB" << endl;
+            return 1;
+        }
+    }
+    if (sizesMB.empty()) {
+        sizesMB.assign(defaultSizesMB, defaultSizesMB + sizeof(defaultSizesMB) / sizeof(defaultSizesMB[0]));
+    }
+
+    Disk* disk = Disk::open(argv[1], UFS_BLOCK_SIZE);
+    disk->setCacheCapacity(0);
+    LocalFileSystem* fileSystem = new LocalFileSystem(disk);
+
+    cout << right << setw(9) << "size"
+         << setw(9) << "blocks"
+         << setw(11) << "write MB/s"
+         << setw(11) << "usec/block"
+         << setw(10) << "io/block"
+         << setw(11) << "read MB/s"
+         << setw(11) << "usec/block"
+         << setw(10) << "io/block"
+         << setw(8) << "tail io" << endl;
+    int returnCode = 0;
+    for (size_t i = 0; i < sizesMB.size(); i++) {
+        if (!runSize(disk, fileSystem, sizesMB[i])) {
+            returnCode = 1;
+            break;
+        }
+    }
+
+    delete fileSystem;
+    delete disk;
+    return returnCode;
+}
@@ -0,0 +1,27 @@
+#include <iostream>
+#include <string>
+
+#include "SnapshotDisk.h"
+#include "ufs.h"
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        cerr << argv[0] << ": diskImageFile overlayFile..." << endl;
+        cerr << "Freezes an image and creates copy-on-write overlays on top of it. Each" << endl;
+        cerr << "overlay is an independent clone of the image as it is now, for example:" << endl;
+        cerr << "    $ " << argv[0] << " a.img a1.ovl a2.ovl" << endl;
+        cerr << "    $ ./ds3mkdir cow:a1.ovl 0 only_in_a1" << endl;
+        cerr << "    $ ./ds3ls cow:a2.ovl /" << endl;
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        if (SnapshotDisk::create(argv[1], argv[i], UFS_BLOCK_SIZE) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
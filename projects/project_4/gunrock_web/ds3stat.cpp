@@ -0,0 +1,83 @@
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Disk.h"
+#include "HttpClient.h"
+#include "LocalFileSystem.h"
+#include "ufs.h"
+
+using namespace std;
+
+void printUsage(const char* program)
+{
+    cerr << program << ": diskImageFile" << endl;
+    cerr << program << ": -s host port" << endl;
+    cerr << "Prints Disk I/O counters and latency histograms, either for a scan that" << endl;
+    cerr << "stats and reads every allocated inode of an image, or from a running server." << endl;
+    cerr << "For example:" << endl;
+    cerr << "    $ " << program << " tests/disk_images/a.img" << endl;
+    cerr << "    $ " << program << " -s localhost 8080" << endl;
+}
+
+// Stat and read every allocated inode so that the counters describe a
+// full cold pass over the file system
+int scanImage(LocalFileSystem* const fileSystem)
+{
+    super_t super;
+    fileSystem->readSuperBlock(&super);
+
+    int inodeBitmapBytes = static_cast<int>(ceil(super.num_inodes / 8.0));
+    vector<unsigned char> inodeBitmap(inodeBitmapBytes);
+    fileSystem->readInodeBitmap(&super, inodeBitmap.data());
+
+    for (int inodeNumber = 0; inodeNumber < super.num_inodes; inodeNumber++) {
+        if ((inodeBitmap[inodeNumber / 8] & (1 << (inodeNumber % 8))) == 0) {
+            continue;
+        }
+        inode_t inode;
+        if (fileSystem->stat(inodeNumber, &inode) != 0) {
+            cerr << "Could not stat inode " << inodeNumber << endl;
+            return 1;
+        }
+        vector<char> data(inode.size);
+        if (fileSystem->read(inodeNumber, data.data(), inode.size) != inode.size) {
+            cerr << "Could not read inode " << inodeNumber << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 4 && string(argv[1]) == "-s") {
+        HttpClient client(argv[2], atoi(argv[3]));
+        HTTPClientResponse* response = client.get("/admin/disk");
+        if (!response->success()) {
+            cerr << "Server returned " << response->status() << endl;
+            delete response;
+            return 1;
+        }
+        cout << response->body();
+        delete response;
+        return 0;
+    }
+
+    if (argc != 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    Disk* disk = Disk::open(argv[1], UFS_BLOCK_SIZE);
+    LocalFileSystem* fileSystem = new LocalFileSystem(disk);
+    int returnCode = scanImage(fileSystem);
+    cout << disk->statsReport();
+    cout << "superblock reads avoided " << fileSystem->superBlockReadsAvoided() << endl;
+    cout << "inode reads avoided      " << fileSystem->inodeReadsAvoided() << endl;
+
+    delete fileSystem;
+    delete disk;
+    return returnCode;
+}
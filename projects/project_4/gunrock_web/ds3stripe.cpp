@@ -0,0 +1,59 @@
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Disk.h"
+#include "ufs.h"
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        cerr << argv[0] << ": diskImageFile stripeFile..." << endl;
+        cerr << "Splits an image round-robin into stripe images for a striped Disk, for example:" << endl;
+        cerr << "    $ " << argv[0] << " a.img a0.img a1.img" << endl;
+        cerr << "    $ ./ds3ls stripe:a0.img,a1.img /" << endl;
+        return 1;
+    }
+
+    Disk* disk = Disk::open(argv[1], UFS_BLOCK_SIZE);
+    int numStripes = argc - 2;
+    int numBlocks = disk->numberOfBlocks();
+    int stripeBlocks = (numBlocks + numStripes - 1) / numStripes;
+
+    vector<int> stripes;
+    for (int i = 0; i < numStripes; i++) {
+        int fd = open(argv[i + 2], O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd < 0 || ftruncate(fd, (off_t) stripeBlocks * UFS_BLOCK_SIZE) != 0) {
+            perror(argv[i + 2]);
+            delete disk;
+            return 1;
+        }
+        stripes.push_back(fd);
+    }
+
+    int returnCode = 0;
+    char buffer[UFS_BLOCK_SIZE];
+    for (int blockNumber = 0; blockNumber < numBlocks; blockNumber++) {
+        disk->readBlock(blockNumber, buffer);
+        off_t offset = (off_t) (blockNumber / numStripes) * UFS_BLOCK_SIZE;
+        if (pwrite(stripes[blockNumber % numStripes], buffer, UFS_BLOCK_SIZE, offset) != UFS_BLOCK_SIZE) {
+            perror("write");
+            returnCode = 1;
+            break;
+        }
+    }
+
+    for (int i = 0; i < numStripes; i++) {
+        if (fsync(stripes[i]) != 0) {
+            perror("fsync");
+            returnCode = 1;
+        }
+        close(stripes[i]);
+    }
+    delete disk;
+    return returnCode;
+}
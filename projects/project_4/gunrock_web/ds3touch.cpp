@@ -46,7 +46,7 @@ int main(int argc, char* argv[])
     }
 
     // Parse command line arguments
-    Disk* disk = new Disk(argv[1], UFS_BLOCK_SIZE);
+    Disk* disk = Disk::open(argv[1], UFS_BLOCK_SIZE);
     LocalFileSystem* fileSystem = new LocalFileSystem(disk);
 
     // validate parent inode
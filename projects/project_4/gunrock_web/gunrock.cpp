@@ -18,6 +18,9 @@
 #include "HttpUtils.h"
 #include "FileService.h"
 #include "DistributedFileSystemService.h"
+#include "DiskStatsService.h"
+#include "Disk.h"
+#include "ufs.h"
 #include "MySocket.h"
 #include "MyServerSocket.h"
 #include "dthread.h"
@@ -30,6 +33,8 @@ string BASEDIR = "static";
 string SCHEDALG = "FIFO";
 string LOGFILE = "/dev/null";
 string DISKFILE = "disk.img";
+int GROUP_COMMIT_USEC = 0;
+int CACHE_BLOCKS = DISK_DEFAULT_CACHE_BLOCKS;
 
 vector<HttpService *> services;
 
@@ -127,7 +132,7 @@ int main(int argc, char *argv[]) {
   signal(SIGPIPE, SIG_IGN);
   int option;
 
-  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:")) != -1) {
+  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:g:c:")) != -1) {
     switch (option) {
     case 'd':
       BASEDIR = string(optarg);
@@ -150,8 +155,14 @@ int main(int argc, char *argv[]) {
     case 'i':
       DISKFILE = string(optarg);
       break;
+    case 'g':
+      GROUP_COMMIT_USEC = atoi(optarg);
+      break;
+    case 'c':
+      CACHE_BLOCKS = atoi(optarg);
+      break;
     default:
-      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-i diskFile]" << endl;
+      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-i [ram:|ramdump:|mmap:|uring:|direct:]diskFile] [-g groupCommitUsec] [-c cacheBlocks]" << endl;
       exit(1);
     }
   }
@@ -166,7 +177,12 @@ int main(int argc, char *argv[]) {
 
   // The order that you push services dictates the search order
   // for path prefix matching
-  services.push_back(new DistributedFileSystemService(DISKFILE));
+  Disk *disk = Disk::open(DISKFILE, UFS_BLOCK_SIZE);
+  disk->setGroupCommitWindow(GROUP_COMMIT_USEC);
+  disk->setCacheCapacity(CACHE_BLOCKS);
+  DistributedFileSystemService *fileSystemService = new DistributedFileSystemService(disk);
+  services.push_back(fileSystemService);
+  services.push_back(new DiskStatsService(disk, fileSystemService->dentries()));
   services.push_back(new FileService(BASEDIR));
   
   while(true) {
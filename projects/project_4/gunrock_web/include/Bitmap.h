@@ -0,0 +1,70 @@
+#ifndef _BITMAP_H_
+#define _BITMAP_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "Disk.h"
+
+/**
+ * An allocation bitmap held in memory.
+ *
+ * The whole on-disk bitmap (every one of its blocks) is read once by
+ * load(). Setting or clearing bits only marks the bitmap blocks they fall
+ * in dirty; flush() writes just those blocks, normally inside the
+ * transaction that made the change, and revert() undoes everything since
+ * the last flush when that transaction is rolled back.
+ *
+ * Bit i is bit i % 8 of byte i / 8, as in the on-disk format. Searches
+ * look at 64 bits at a time (256 on CPUs with AVX2), so finding a
+ * free bit costs one instruction per 64 used ones. A next-fit bitmap
+ * starts each search at the word of the previous allocation instead of
+ * at bit 0, so a filling disk does not rescan its used prefix every time.
+ */
+class Bitmap {
+ public:
+  Bitmap(bool nextFit = false);
+  ~Bitmap();
+
+  // Read the length blocks at address that hold numBits bits
+  void load(Disk *disk, int address, int length, int numBits);
+
+  bool isSet(int bit);
+  void set(int bit);
+  void clear(int bit);
+
+  // Set the first clear bit (at or after the next-fit cursor, wrapping
+  // around) and return it, or -1 if every bit is set
+  int allocate();
+  // Set count clear bits in a row, found in one pass the same way, and
+  // return the first, or -1 if there is no run that long
+  int allocateRun(int count);
+
+  // Copy the ceil(numBits / 8) bitmap bytes out of or into the bitmap
+  void copyTo(unsigned char *bits);
+  void copyFrom(const unsigned char *bits);
+
+  // Write the dirty blocks to disk, or put them back as they were
+  void flush(Disk *disk);
+  void revert();
+
+ private:
+  void markDirty(int byteIndex);
+  uint64_t word(size_t index);
+  int findClear(size_t first, size_t last);
+  int findClearRun(int first, int last, int count);
+
+  int address;
+  int numBits;
+  int blockSize;
+  bool nextFit;
+  size_t cursor;  // word index of the last allocation
+  std::vector<unsigned char> bytes;
+  // bitmap block index -> its contents at the last flush
+  std::map<int, std::vector<unsigned char> > dirty;
+  pthread_mutex_t lock;
+};
+
+#endif
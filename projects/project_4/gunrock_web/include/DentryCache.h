@@ -0,0 +1,78 @@
+#ifndef _DENTRYCACHE_H_
+#define _DENTRYCACHE_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "DiskStats.h"
+#include "LocalFileSystem.h"
+
+// Most (parent, name) entries a DentryCache keeps before evicting
+#define DENTRY_CACHE_DEFAULT_ENTRIES (8192)
+
+/**
+ * A bounded cache of directory entries in front of a LocalFileSystem.
+ *
+ * Each entry maps (parent inode, name) to the inode found there, or
+ * records that the name is not there (a negative entry), so resolving
+ * a path that was resolved recently costs no directory reads at all.
+ * The least recently used entry is evicted once the cache is full.
+ *
+ * Entries only change through create() and unlink(), which update
+ * exactly the entries the operation affects, so every change to the
+ * namespace has to go through them. Lookups that miss remember the
+ * cache generation and only fill the cache if no create or unlink ran
+ * meanwhile, so a slow lookup cannot bring back a stale entry.
+ */
+class DentryCache {
+ public:
+  DentryCache(LocalFileSystem *fileSystem, int capacity = DENTRY_CACHE_DEFAULT_ENTRIES);
+  ~DentryCache();
+
+  // The same as the LocalFileSystem calls, but through the cache
+  int lookup(int parentInodeNumber, std::string name);
+  int create(int parentInodeNumber, int type, std::string name);
+  int unlink(int parentInodeNumber, std::string name);
+
+  // Time taken to resolve one whole path, recorded by the caller
+  void recordResolution(unsigned long usec);
+
+  unsigned long hits();
+  unsigned long misses();
+  unsigned long evictions();
+  int size();
+
+  // Hit rate and resolution latency as text, in the style of Disk::statsReport
+  std::string statsReport();
+
+ private:
+  typedef std::pair<int, std::string> Key;
+  struct Entry {
+    Key key;
+    int inodeNumber;  // -ENOTFOUND for a negative entry
+  };
+
+  void insert(const Key &key, int inodeNumber);
+  void erase(const Key &key);
+  void eraseChildren(int parentInodeNumber);
+
+  LocalFileSystem *fileSystem;
+  size_t capacity;
+
+  // most recently used first, with an index by key; protected by lock
+  std::list<Entry> lru;
+  std::map<Key, std::list<Entry>::iterator> entries;
+  unsigned long generation;
+  pthread_mutex_t lock;
+
+  std::atomic<unsigned long> hitCount;
+  std::atomic<unsigned long> missCount;
+  std::atomic<unsigned long> evictionCount;
+  LatencyHistogram resolutionLatency;
+};
+
+#endif
@@ -2,30 +2,76 @@
 #define _DISK_H_
 
 #include <string>
-#include <deque>
 
-struct UndoRecord {
-  int blockNumber;
-  unsigned char *blockData;
-};
+#include "DiskStats.h"
+
+// Default size of the block cache, in blocks
+#define DISK_DEFAULT_CACHE_BLOCKS (256)
 
+/**
+ * A block device holding a file system image.
+ *
+ * Use Disk::open to get one. FileDisk works on the image file itself,
+ * RamDisk works on an in-memory copy of it for benchmarks and hermetic
+ * tests, StripedDisk spreads the blocks over several other Disks, and
+ * SnapshotDisk keeps the changes to a frozen image in an overlay file.
+ *
+ * Writes made between beginTransaction() and commit() become visible to
+ * other threads, and durable, together at commit; rollback() drops them.
+ * A write made outside a transaction is a transaction of its own.
+ */
 class Disk {
  public:
-  Disk(std::string imageFile, int blockSize);
+  // imageFile is a path to the image, optionally prefixed with a mode:
+  //   "ram:"     load the image into memory; changes are thrown away
+  //   "ramdump:" load the image into memory and write changes back when
+  //              the Disk is deleted
+  //   "stripe:"  stripe across a comma separated list of images, each of
+  //              which may have its own prefix (see StripedDisk)
+  //   "cow:"     imageFile is an overlay made by ds3snap; read the frozen
+  //              base it names and write to the overlay (see SnapshotDisk)
+  //   "mmap:", "uring:", "direct:"  see FileDisk
+  static Disk *open(std::string imageFile, int blockSize);
+
+  virtual ~Disk();
+
   void readBlock(int blockNumber, void *buffer);
   void writeBlock(int blockNumber, void *buffer);
-  int numberOfBlocks();
-
-  void beginTransaction();
-  void commit();
-  void rollback();
-  
- private:
-  std::string imageFile;
-  int blockSize;
-  int imageFileSize;
-  bool isInTransaction;
-  std::deque<struct UndoRecord> undoLog;
+
+  // Read or write count blocks to or from one contiguous buffer
+  virtual void readBlocks(const int *blockNumbers, int count, void *buffer) = 0;
+  virtual void writeBlocks(const int *blockNumbers, int count, const void *buffer) = 0;
+
+  // Zero a block without writing it; reading it afterwards returns zeros
+  virtual void discardBlock(int blockNumber) = 0;
+
+  // Number of blocks available to the file system
+  virtual int numberOfBlocks() = 0;
+
+  virtual void beginTransaction() = 0;
+  virtual void commit() = 0;
+  virtual void rollback() = 0;
+
+  // Number of I/O system calls issued so far
+  virtual unsigned long syscallCount();
+
+  // Counters and latency histograms for the I/O done so far, and a
+  // printable summary of them (what ds3stat and the server print)
+  const DiskStats& stats();
+  std::string statsReport();
+
+  // Let a committing transaction wait up to usec microseconds for other
+  // transactions to commit so they can all share one fdatasync (0 = off).
+  virtual void setGroupCommitWindow(int usec);
+
+  // Resize the block cache (0 turns it off), dropping anything cached
+  virtual void setCacheCapacity(int blocks);
+  virtual unsigned long cacheHits();
+  virtual unsigned long cacheMisses();
+  virtual unsigned long cacheEvictions();
+
+ protected:
+  DiskStats diskStats;
 };
 
 #endif
@@ -0,0 +1,60 @@
+#ifndef _DISKSTATS_H_
+#define _DISKSTATS_H_
+
+#include <atomic>
+#include <string>
+
+// Bucket 0 counts operations that took under 1 usec, bucket i those
+// that took [2^(i-1), 2^i) usec, and the last bucket everything slower.
+#define DISK_LATENCY_BUCKETS (25)
+
+/**
+ * A latency histogram with power-of-two microsecond buckets. Recording a
+ * sample is a few relaxed atomic increments, so it can be read while
+ * other threads keep recording.
+ */
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+  void record(unsigned long usec);
+
+  unsigned long count() const;
+  unsigned long totalUsec() const;
+  unsigned long bucket(int index) const;
+  // Smallest bucket upper bound, in usec, that covers fraction of the samples
+  unsigned long percentile(double fraction) const;
+
+  // "count N avg A p50 B p99 C" followed by one line per non-empty bucket
+  std::string report(std::string indent) const;
+
+ private:
+  std::atomic<unsigned long> samples;
+  std::atomic<unsigned long> total;
+  std::atomic<unsigned long> buckets[DISK_LATENCY_BUCKETS];
+};
+
+/**
+ * I/O counters kept by a Disk. Every field is a lock-free atomic so that
+ * the counters can be read through Disk::stats() while the Disk is in use.
+ */
+struct DiskStats {
+  DiskStats();
+
+  std::atomic<unsigned long> blocksRead;      // blocks read from the image
+  std::atomic<unsigned long> bytesRead;
+  std::atomic<unsigned long> blocksWritten;   // blocks written to the image
+  std::atomic<unsigned long> bytesWritten;
+  std::atomic<unsigned long> syncs;           // fdatasync, msync and fsync
+  std::atomic<unsigned long> discards;        // blocks discarded
+  std::atomic<unsigned long> journalRecords;  // transactions appended to the journal
+  std::atomic<unsigned long> checkpoints;     // journal checkpoints
+  std::atomic<unsigned long> commits;
+  std::atomic<unsigned long> rollbacks;
+
+  LatencyHistogram readLatency;         // each read request sent to the image
+  LatencyHistogram writeLatency;        // each write request sent to the image
+  LatencyHistogram syncLatency;         // each flush of the image
+  LatencyHistogram transactionLatency;  // beginTransaction to durable commit
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _DISKSTATSSERVICE_H_
+#define _DISKSTATSSERVICE_H_
+
+#include "HttpService.h"
+#include "DentryCache.h"
+#include "Disk.h"
+
+#include <string>
+
+// Serves the Disk I/O counters, followed by the dentry cache's if there
+// is one, as text on GET /admin/disk
+class DiskStatsService : public HttpService {
+ public:
+  DiskStatsService(Disk *disk, DentryCache *dentries = NULL);
+
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+
+private:
+  Disk *disk;
+  DentryCache *dentries;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef _DISTRIBUTEDFILESYSTEMSERVICE_H_
 #define _DISTRIBUTEDFILESYSTEMSERVICE_H_
 
+#include "DentryCache.h"
 #include "HttpService.h"
 #include "LocalFileSystem.h"
 
@@ -8,14 +9,18 @@
 
 class DistributedFileSystemService : public HttpService {
  public:
-  DistributedFileSystemService(std::string driveFile);
+  DistributedFileSystemService(Disk *disk);
 
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void put(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
 
+  // Path components are resolved through this cache
+  DentryCache *dentries();
+
 private:
   LocalFileSystem *fileSystem;
+  DentryCache *dentryCache;
 };
 
 #endif
@@ -0,0 +1,165 @@
+#ifndef _FILEDISK_H_
+#define _FILEDISK_H_
+
+#include <atomic>
+#include <pthread.h>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Disk.h"
+#include "IoRing.h"
+
+// How FileDisk reaches the image file
+enum DiskMode {
+  DISK_MODE_FILE,   // pread/pwrite on the image file
+  DISK_MODE_MMAP,   // memcpy against a shared mapping of the whole image
+  DISK_MODE_URING,  // batched io_uring submissions on the image file
+  DISK_MODE_DIRECT  // O_DIRECT pread/pwrite that bypass the page cache
+};
+
+/**
+ * A Disk backed by a disk image file.
+ *
+ * imageFile is normally a path to the image. Prefixing it with "mmap:"
+ * (for example "mmap:tests/disk_images/a.img") maps the whole image into
+ * memory and serves block reads and writes as memcpy. Prefixing it with
+ * "uring:" sends the block reads of one readBlocks call to the kernel as
+ * a single io_uring batch, and commits as writes linked to their fsync.
+ * Prefixing it with "direct:" opens the image with O_DIRECT so that
+ * blocks are not also kept in the page cache; transfers are staged
+ * through a pool of aligned block buffers.
+ *
+ * Writes made between beginTransaction() and commit() are held in memory
+ * and applied together at commit with a single barrier. If the image has
+ * a redo journal (see ufs.h and mkfs -j), commit appends the new block
+ * images to the journal sequentially and they are checkpointed to their
+ * home locations later; a journal left behind by a crash is replayed
+ * when the FileDisk is constructed.
+ *
+ * Committed blocks are kept in a fixed-capacity LRU block cache so that
+ * hot metadata such as the super block and the bitmaps is read from the
+ * image only once. The cache is not used in mmap mode.
+ */
+class FileDisk : public Disk {
+ public:
+  FileDisk(std::string imageFile, int blockSize);
+  virtual ~FileDisk();
+
+  // Runs of physically contiguous blocks reach the image in a single
+  // preadv or pwritev.
+  virtual void readBlocks(const int *blockNumbers, int count, void *buffer);
+  virtual void writeBlocks(const int *blockNumbers, int count, const void *buffer);
+
+  // Once committed, a discarded block is a hole in the image where the
+  // host file system supports it; its old contents are unspecified after
+  // a crash.
+  virtual void discardBlock(int blockNumber);
+
+  // The journal is not included
+  virtual int numberOfBlocks();
+
+  // Number of I/O system calls (pread, pwrite, fdatasync, msync) issued so far
+  virtual unsigned long syscallCount();
+
+  virtual void beginTransaction();
+  virtual void commit();
+  virtual void rollback();
+
+  virtual void setGroupCommitWindow(int usec);
+  virtual void setCacheCapacity(int blocks);
+  virtual unsigned long cacheHits();
+  virtual unsigned long cacheMisses();
+  virtual unsigned long cacheEvictions();
+
+ private:
+  void readBlockData(int blockNumber, int count, void *buffer);
+  void writeBlockData(int blockNumber, int count, void *buffer);
+  void readRequests(std::vector<IoRequest>& requests);
+  bool writeRequests(std::vector<IoRequest>& requests, bool sync);
+  bool writeBlockMap(std::map<int, std::vector<unsigned char> >& blocks, bool sync);
+  bool readBufferedBlock(int blockNumber, void *buffer, unsigned long generation);
+  void discardBlockData();
+  void recordRequests(const std::vector<IoRequest>& requests, bool write, unsigned long usec);
+  std::vector<struct iovec> acquireAlignedIovecs(const std::vector<struct iovec>& iov, bool copy);
+  void releaseAlignedIovecs(std::vector<struct iovec>& aligned, const std::vector<struct iovec>& iov, bool copy);
+  void *acquireAlignedBuffer();
+  void releaseAlignedBuffer(void *buffer);
+  void syncMapping(int low, int high);
+  void groupSync();
+  void flush(int low, int high);
+  void syncAll();
+  bool inOwnTransaction();
+  bool readCachedBlock(int blockNumber, void *buffer);
+  unsigned long cacheGeneration();
+  void cacheBlock(int blockNumber, const void *buffer, unsigned long generation);
+  void cacheCommittedBlock(int blockNumber, const void *buffer);
+  void storeCachedBlock(int blockNumber, const void *buffer);
+
+  void recoverJournal();
+  bool journalHasRoom(int numBlocks);
+  bool appendJournal();
+  void checkpointJournal();
+
+  std::string imageFile;
+  DiskMode mode;
+  int fd;
+  bool readOnly;
+  unsigned char *mapping;
+  IoRing *ring;
+  int blockSize;
+  off_t imageFileSize;
+  int totalBlocks;
+  bool isInTransaction;
+  std::atomic<unsigned long> syscalls;
+
+  // blocks written by the current transaction, applied at commit
+  std::map<int, std::vector<unsigned char> > pending;
+  // blocks discarded by the current transaction
+  std::set<int> discards;
+  pthread_mutex_t transactionLock;
+  pthread_t transactionOwner;
+  unsigned long transactionStartUsec;
+
+  // group commit state, protected by syncLock
+  pthread_mutex_t syncLock;
+  pthread_cond_t syncCond;
+  int groupCommitWindowUsec;
+  unsigned long syncRequested;
+  unsigned long syncCompleted;
+  bool syncing;
+
+  // redo journal; journalLen is 0 when the image does not have one
+  int journalStart;
+  int journalLen;
+  int journalHead;
+  unsigned int journalSeq;
+  // committed blocks not yet checkpointed, protected by journalLock
+  std::map<int, std::vector<unsigned char> > journaled;
+  pthread_mutex_t journalLock;
+
+  // LRU block cache of committed images, protected by cacheLock; the
+  // front of cacheOrder is the most recently used block, and generation
+  // counts the commits that changed cached blocks
+  struct CacheEntry {
+    std::vector<unsigned char> data;
+    std::list<int>::iterator position;
+  };
+  int cacheCapacity;
+  std::unordered_map<int, CacheEntry> cache;
+  std::list<int> cacheOrder;
+  unsigned long generation;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  pthread_mutex_t cacheLock;
+
+  // free aligned block buffers for O_DIRECT transfers, protected by poolLock
+  std::vector<void *> alignedBuffers;
+  pthread_mutex_t poolLock;
+};
+
+#endif
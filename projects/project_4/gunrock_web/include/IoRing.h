@@ -0,0 +1,78 @@
+#ifndef _IORING_H_
+#define _IORING_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <vector>
+
+// Depth of the submission queue; bigger batches are split
+#define IORING_DEFAULT_ENTRIES (64)
+
+// One readv, writev or fdatasync against a file
+struct IoRequest {
+  int opcode;                     // IORING_OP_READV, IORING_OP_WRITEV or IORING_OP_FSYNC
+  off_t offset;
+  std::vector<struct iovec> iov;  // empty for IORING_OP_FSYNC
+};
+
+// What a submission's user_data points to: the bytes it has to transfer
+// and the count of its batch's requests still in flight
+struct IoCompletion {
+  long expected;
+  unsigned int *remaining;
+};
+
+/**
+ * A minimal io_uring submission/completion ring, set up with the raw
+ * system calls so that it does not depend on liburing.
+ *
+ * submit() queues a whole batch of requests, hands them to the kernel
+ * with a single io_uring_enter and waits for every completion. Threads
+ * share one ring and their batches are in flight together: the ring is
+ * only locked to fill submission entries and to reap completions, which
+ * are matched to their batch by user_data. Whichever waiting thread gets
+ * there first waits in the kernel and reaps for all of them.
+ */
+class IoRing {
+ public:
+  IoRing(int entries);
+  ~IoRing();
+
+  // Run every request in requests against fd. With linked set, each
+  // request starts only after the one before it has finished (write
+  // then fsync). Returns the number of io_uring_enter calls made.
+  int submit(int fd, std::vector<IoRequest>& requests, bool linked);
+
+ private:
+  int enter(unsigned int toSubmit, unsigned int minComplete);
+  void reap();
+
+  int ringFd;
+  // protects the queues, inFlight and reaping; ringCond is signalled
+  // whenever completions have been reaped
+  pthread_mutex_t ringLock;
+  pthread_cond_t ringCond;
+  unsigned int inFlight;
+  bool reaping;
+
+  void *sqRing;
+  size_t sqRingSize;
+  void *cqRing;
+  size_t cqRingSize;
+  struct io_uring_sqe *sqes;
+  size_t sqesSize;
+
+  unsigned int *sqHead;
+  unsigned int *sqTail;
+  unsigned int *sqMask;
+  unsigned int *sqArray;
+  unsigned int sqEntries;
+  unsigned int *cqHead;
+  unsigned int *cqTail;
+  unsigned int *cqMask;
+  struct io_uring_cqe *cqes;
+};
+
+#endif
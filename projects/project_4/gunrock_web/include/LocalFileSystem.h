@@ -1,8 +1,15 @@
 #ifndef _LOCAL_FILE_SYSTEM_H_
 #define _LOCAL_FILE_SYSTEM_H_
 
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "Bitmap.h"
 #include "Disk.h"
 #include "ufs.h"
 
@@ -44,9 +51,15 @@
 // Unlinking '.' or '..'
 #define EUNLINKNOTALLOWED  (10)
 
+// Most directories whose name index is kept in memory at once
+#define LFS_DIRECTORY_INDEX_MAX (4096)
+// Memory given to cached inodes, in bytes of inode_t
+#define LFS_INODE_CACHE_BYTES (1 << 20)
+
 class LocalFileSystem {
  public:
   LocalFileSystem(Disk *disk);
+  ~LocalFileSystem();
   /**
    * Lookup an inode.
    *
@@ -54,6 +67,11 @@ class LocalFileSystem {
    * of a directory) and looks up the entry name in it. The inode
    * number of name is returned.
    *
+   * The first lookup in a directory indexes all of its entries in a hash
+   * table, so later lookups there don't scan it. Creating or unlinking
+   * an entry updates the index as the operation commits; other changes
+   * to the directory drop it.
+   *
    * Success: return inode number of name
    * Failure: return -ENOTFOUND, -EINVALIDINODE.
    * Failure modes: invalid parentInodeNumber, name does not exist.
@@ -66,11 +84,23 @@ class LocalFileSystem {
    * Given an inodeNumber this function will fill in the `inode` struct with
    * the type of the entry and the size of the data, in bytes, and direct blocks.
    *
+   * Inodes are cached in memory once read, and updated in the cache when
+   * an operation that changed them commits, so repeated stats of the same
+   * inode don't read the disk.
+   *
+   * A small file whose data is inline (see ufs.h) is reported as a plain
+   * UFS_REGULAR_FILE; its direct[] holds the data rather than blocks.
+   *
    * Success: return 0
    * Failure: return -EINVALIDINODE
    * Failure modes: invalid inodeNumber
    */
   int stat(int inodeNumber, inode_t *inode);
+
+  // Stat count inodes into inodes[0..count). The inodes that are not
+  // cached are read with one request, each inode block once. Returns 0,
+  // or -EINVALIDINODE (and fills in nothing) if any number is invalid.
+  int statMany(const int *inodeNumbers, int count, inode_t *inodes);
   
   /**
    * Makes a file or directory.
@@ -113,6 +143,29 @@ class LocalFileSystem {
    */
   int read(int inodeNumber, void *buffer, int size);
 
+  /**
+   * Read or write part of a file.
+   *
+   * pread reads up to `size` bytes starting `offset` bytes into the file
+   * or directory, stopping at its end. pwrite writes `size` bytes at
+   * `offset` into a regular file, leaving the rest of it as it was, and
+   * extends it (with zeros between the old end and `offset`) if the write
+   * goes past the end. Only the blocks the range covers are read or
+   * written, and blocks are only allocated when the file grows.
+   *
+   * Success: number of bytes read or written
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EINVALIDTYPE, -ENOTENOUGHSPACE.
+   * Failure modes: invalid inodeNumber, negative size or offset, a write
+   * past the largest file size, pwrite to a directory, or not enough
+   * space to grow the file (nothing is written then).
+   */
+  int pread(int inodeNumber, void *buffer, int size, int offset);
+  int pwrite(int inodeNumber, const void *buffer, int size, int offset);
+
+  // The data blocks of a file or directory in file order and, if asked
+  // for, the indirect blocks that map them. Returns 0 or -EINVALIDINODE.
+  int fileBlocks(int inodeNumber, std::vector<int> &dataBlocks, std::vector<int> *indirectBlocks = NULL);
+
   /**
    * Remove a file or directory.
    *
@@ -135,7 +188,37 @@ class LocalFileSystem {
    */
   void readSuperBlock(super_t *super);
 
-  // Helper functions, you should read/write the entire inode and bitmap regions
+  // The superblock is read once, when the LocalFileSystem is constructed,
+  // and readSuperBlock hands out that copy. Nothing in this class changes
+  // block 0; call invalidateSuperBlock after rewriting it some other way.
+  void invalidateSuperBlock();
+  // Number of readSuperBlock calls served without reading block 0
+  unsigned long superBlockReadsAvoided();
+  // Number of inodes stat served from the inode cache
+  unsigned long inodeReadsAvoided();
+
+  // Update one inode. Inside a file system operation the inode is kept
+  // in a dirty set, seen by stat, and written with the operation's commit,
+  // so only the inode blocks that changed are written.
+  int writeInode(int inodeNumber, const inode_t &inode);
+
+  // Allocate or free an inode or a data block (an absolute block number)
+  // in the in-memory bitmaps. The bitmap blocks they change are written
+  // when the operation's transaction commits; called outside of one, each
+  // is an operation of its own, as writeInode is. Allocating returns
+  // -ENOTENOUGHSPACE when nothing is free; freeing a data block outside
+  // the data region returns -1.
+  int allocateInode();
+  void freeInode(int inodeNumber);
+  int allocateDataBlock();
+  int freeDataBlock(int blockNumber);
+  // Allocate count contiguous data blocks and return the first, or
+  // -ENOTENOUGHSPACE if no free run is that long
+  int allocateDataBlocks(int count);
+
+  // Helper functions, you should read/write the entire inode and bitmap regions.
+  // The bitmaps are kept in memory: reading one copies it out, and writing
+  // one writes the bitmap blocks that changed.
   void readInodeBitmap(super_t *super, unsigned char *inodeBitmap);
   void writeInodeBitmap(super_t *super, unsigned char *inodeBitmap);
   void readDataBitmap(super_t *super, unsigned char *dataBitmap);
@@ -147,6 +230,57 @@ class LocalFileSystem {
   // it in a function you add that is not part of the LocalFileSystem object but
   // can still access the disk.
   Disk *disk;
+
+ private:
+  // A file system operation is one Disk transaction. Ending it writes
+  // or drops the dirty inodes and bitmap blocks along with it.
+  void beginTransaction();
+  void commitTransaction();
+  void rollbackTransaction();
+  bool inOwnTransaction();
+  void flushInodes();
+  // statMany, but with the UFS_INLINE_DATA flag left in type
+  int readInodes(const int *inodeNumbers, int count, inode_t *inodes);
+
+  super_t superBlock;
+  bool superBlockValid;
+  pthread_mutex_t superBlockLock;
+  std::atomic<unsigned long> superBlockHits;
+  Bitmap inodeBitmap;
+  Bitmap dataBitmap;
+
+  // name -> inode number for one directory, valid while generation is
+  // unchanged
+  struct DirectoryIndex {
+    DirectoryIndex() : generation(0), built(false) {}
+    unsigned long generation;
+    bool built;
+    std::unordered_map<std::string, int> names;
+  };
+  DirectoryIndex& directoryIndex(int inodeNumber);
+  std::unordered_map<int, DirectoryIndex> directoryIndexes;
+  // Entries the current operation added (name -> inode number) or
+  // removed (name -> -ENOTFOUND), by directory
+  std::map<int, std::vector<std::pair<std::string, int> > > directoryChanges;
+  unsigned long directoryIndexClock;
+  pthread_mutex_t directoryIndexLock;
+
+  // Committed inodes, most recently used first, with an index by inode
+  // number. A read that misses only fills the cache if no commit bumped
+  // the generation meanwhile. Protected by inodeCacheLock.
+  typedef std::list<std::pair<int, inode_t> > InodeList;
+  void cacheInode(int inodeNumber, const inode_t &inode);
+  InodeList inodeCache;
+  std::unordered_map<int, InodeList::iterator> inodeCacheIndex;
+  size_t inodeCacheCapacity;
+  unsigned long inodeCacheGeneration;
+  pthread_mutex_t inodeCacheLock;
+  std::atomic<unsigned long> inodeCacheHits;
+
+  // inodes changed by the current operation, by inode number
+  std::map<int, inode_t> dirtyInodes;
+  bool isInTransaction;
+  pthread_t transactionOwner;
 };  
 
 #endif
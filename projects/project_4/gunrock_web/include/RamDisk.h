@@ -0,0 +1,63 @@
+#ifndef _RAMDISK_H_
+#define _RAMDISK_H_
+
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Disk.h"
+
+/**
+ * A Disk held entirely in memory.
+ *
+ * The image file is read in once when the RamDisk is constructed (any
+ * journal in it is recovered first) and is not touched again unless
+ * dump() is called, or dumpOnClose is set and the RamDisk is deleted.
+ * Nothing is ever flushed, so timings measure the file system code
+ * rather than the device.
+ */
+class RamDisk : public Disk {
+ public:
+  RamDisk(std::string imageFile, int blockSize, bool dumpOnClose);
+  virtual ~RamDisk();
+
+  virtual void readBlocks(const int *blockNumbers, int count, void *buffer);
+  virtual void writeBlocks(const int *blockNumbers, int count, const void *buffer);
+  virtual void discardBlock(int blockNumber);
+  virtual int numberOfBlocks();
+
+  virtual void beginTransaction();
+  virtual void commit();
+  virtual void rollback();
+
+  // Write every block changed since the image was loaded back to it, as
+  // one transaction on the image file. The dump is atomic only when the
+  // image's journal can hold it: at most JOURNAL_DESC_MAX_BLOCKS blocks
+  // and journal_len - 2.
+  void dump();
+
+ private:
+  bool inOwnTransaction();
+  void checkBlockNumber(int blockNumber);
+
+  std::string imageFile;
+  int blockSize;
+  int totalBlocks;
+  bool dumpOnClose;
+
+  // the committed image, and the blocks that differ from the file;
+  // protected by imageLock
+  std::vector<unsigned char> image;
+  std::set<int> dirty;
+  pthread_mutex_t imageLock;
+
+  // blocks written by the current transaction, applied at commit
+  std::map<int, std::vector<unsigned char> > pending;
+  bool isInTransaction;
+  pthread_mutex_t transactionLock;
+  pthread_t transactionOwner;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _SNAPSHOTDISK_H_
+#define _SNAPSHOTDISK_H_
+
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Disk.h"
+#include "ufs.h"
+
+/**
+ * A copy-on-write view of a frozen base image.
+ *
+ * The base is never written. Every block the file system writes or
+ * discards is remapped to a block of an overlay file (see
+ * overlay_super_t in ufs.h) and all later reads of it go there; blocks
+ * that were never written are read from the base. Any number of
+ * overlays can share one base, so cloning a populated image costs one
+ * header block instead of a copy of the image. An overlay's base may
+ * itself be an overlay ("cow:older.ovl"). The overlay records the
+ * base's file size, modification time, inode number and a hash of its
+ * block 0, and refuses to open if any of them changed.
+ *
+ * Transactions are held here and committed to the overlay in one
+ * overlay transaction together with the remap table blocks they changed.
+ * The in-memory remap table is only updated once that commit returns.
+ */
+class SnapshotDisk : public Disk {
+ public:
+  // overlayFile is an overlay created by SnapshotDisk::create
+  SnapshotDisk(std::string overlayFile, int blockSize);
+  virtual ~SnapshotDisk();
+
+  // Write protect the image named by baseImage (a Disk::open spec) and
+  // create an empty overlay on top of it. Returns 0, or -1 with a message
+  // on stderr.
+  static int create(std::string baseImage, std::string overlayFile, int blockSize);
+
+  virtual void readBlocks(const int *blockNumbers, int count, void *buffer);
+  virtual void writeBlocks(const int *blockNumbers, int count, const void *buffer);
+  virtual void discardBlock(int blockNumber);
+  virtual int numberOfBlocks();
+
+  virtual void beginTransaction();
+  virtual void commit();
+  virtual void rollback();
+
+  // Blocks remapped to the overlay so far
+  int mappedBlocks();
+
+  virtual unsigned long syscallCount();
+  virtual void setGroupCommitWindow(int usec);
+  virtual void setCacheCapacity(int blocks);
+  virtual unsigned long cacheHits();
+  virtual unsigned long cacheMisses();
+  virtual unsigned long cacheEvictions();
+
+ private:
+  bool inOwnTransaction();
+  void checkBlockNumber(int blockNumber);
+  int remapped(int blockNumber);
+
+  // block 0 of the overlay as last committed
+  overlay_super_t header;
+  std::string baseImage;
+  Disk *base;
+  Disk *overlay;
+  int blockSize;
+  int totalBlocks;
+  int tableLength;
+  int dataStart;
+
+  // base block -> overlay block (0 = not remapped) and the number of
+  // overlay data blocks handed out; protected by remapLock
+  std::vector<int> remap;
+  int numMapped;
+  pthread_mutex_t remapLock;
+
+  // blocks written and discarded by the current transaction
+  std::map<int, std::vector<unsigned char> > pending;
+  std::set<int> discards;
+  // overlay blocks handed out by the commit in progress
+  std::map<int, int> newlyMapped;
+  bool isInTransaction;
+  pthread_mutex_t transactionLock;
+  pthread_t transactionOwner;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef _STRIPEDDISK_H_
+#define _STRIPEDDISK_H_
+
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Disk.h"
+
+class StripedDisk;
+
+// The blocks one stripe has to read, or write and discard, for a request
+struct StripeTask {
+  int stripe;
+  std::vector<int> blocks;           // member block numbers
+  std::vector<int> positions;        // where each block sits in the caller's buffer
+  std::vector<unsigned char> data;   // block images, in the order of blocks
+  std::vector<int> discards;         // member block numbers to discard
+  bool commit;                       // write and discard in one member transaction
+};
+
+// Tasks handed to stripe workers wait on one of these until all are done
+struct StripeBatch {
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  int remaining;
+};
+
+/**
+ * A Disk that stripes block numbers round-robin across several member
+ * Disks: block b is block b / N of member b % N. Each member has a
+ * worker thread, so a request that touches several stripes is served by
+ * all of them in parallel.
+ *
+ * Transactions are held here and committed to each touched member in a
+ * member transaction of its own, all in parallel. A crash can therefore
+ * leave a transaction applied to some stripes but not to others.
+ */
+class StripedDisk : public Disk {
+ public:
+  // members are image specs for Disk::open, such as "a.img" or "direct:b.img"
+  StripedDisk(const std::vector<std::string>& members, int blockSize);
+  virtual ~StripedDisk();
+
+  virtual void readBlocks(const int *blockNumbers, int count, void *buffer);
+  virtual void writeBlocks(const int *blockNumbers, int count, const void *buffer);
+  virtual void discardBlock(int blockNumber);
+  virtual int numberOfBlocks();
+
+  virtual void beginTransaction();
+  virtual void commit();
+  virtual void rollback();
+
+  virtual unsigned long syscallCount();
+  virtual void setGroupCommitWindow(int usec);
+  virtual void setCacheCapacity(int blocks);
+  virtual unsigned long cacheHits();
+  virtual unsigned long cacheMisses();
+  virtual unsigned long cacheEvictions();
+
+ private:
+  struct Worker {
+    StripedDisk *owner;
+    int stripe;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    std::deque<std::pair<StripeTask *, StripeBatch *> > tasks;
+    bool stopping;
+  };
+
+  static void *workerMain(void *arg);
+  void runTask(StripeTask *task);
+  void runTasks(std::vector<StripeTask>& tasks);
+  bool inOwnTransaction();
+  void checkBlockNumber(int blockNumber);
+
+  std::vector<Disk *> disks;
+  std::vector<Worker *> workers;
+  int blockSize;
+  int totalBlocks;
+
+  // blocks written and discarded by the current transaction
+  std::map<int, std::vector<unsigned char> > pending;
+  std::set<int> discards;
+  bool isInTransaction;
+  pthread_mutex_t transactionLock;
+  pthread_t transactionOwner;
+};
+
+#endif
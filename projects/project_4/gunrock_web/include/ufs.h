@@ -12,6 +12,30 @@
 
 #define MAX_FILE_SIZE (DIRECT_PTRS * UFS_BLOCK_SIZE)
 
+// Inode versions, recorded in super_t.version. In a version 1 image every
+// pointer in direct[] is a data block. A version 2 image gives the last
+// two over to indirect blocks: direct[INDIRECT_PTR] points to a block of
+// INDIRECT_PTRS data block addresses, direct[DOUBLE_INDIRECT_PTR] to a
+// block of addresses of such blocks, so the first DIRECT_PTRS_V2 blocks
+// of a file are direct as before. Unused pointers hold -1 (UINT_MAX).
+#define UFS_VERSION_DIRECT (1)
+#define UFS_VERSION_INDIRECT (2)
+
+#define DIRECT_PTRS_V2 (DIRECT_PTRS - 2)
+#define INDIRECT_PTR (DIRECT_PTRS - 2)
+#define DOUBLE_INDIRECT_PTR (DIRECT_PTRS - 1)
+#define INDIRECT_PTRS (UFS_BLOCK_SIZE / sizeof(unsigned int))
+
+// A version 2 file could have more blocks than an int size can count
+#define MAX_FILE_SIZE_V2 (0x7fffffff)
+
+// Version 3 adds inline data to version 2: a regular file of at most
+// INLINE_DATA_MAX bytes keeps them in direct[] itself, zero padded,
+// instead of in a data block, and has UFS_INLINE_DATA set in its type.
+#define UFS_VERSION_INLINE (3)
+#define UFS_INLINE_DATA (0x100)
+#define INLINE_DATA_MAX (DIRECT_PTRS * sizeof(unsigned int))
+
 // Note: Bitmap indexes identify disk blocks relative to the start of a region.
 
 typedef struct {
@@ -47,7 +71,76 @@ typedef struct __super
     int data_region_len; // in blocks
     int num_inodes; // just the number of inodes
     int num_data; // and data blocks...
+    int version; // UFS_VERSION_*; images older than versions hold 0 here, read as 1
+    int journal_addr; // block address of the redo journal, 0 if there is none
+    int journal_len; // in blocks, not counting the journal_super_t after it
 }
 super_t;
 
+// Optional redo journal. super_t.journal_addr and journal_len say whether
+// an image has one: the journal_len blocks at journal_addr, right after
+// the data region, hold the log, and the block after them (the last block
+// of the image) holds a journal_super_t. Images without one (mkfs -j 0,
+// and those made before journals) hold 0 in both fields.
+// Each committed transaction is appended to the log as a journal_desc_t,
+// the new images of the blocks it wrote, and a journal_commit_t. The log
+// is replayed in place (checkpointed) when it fills up or the disk is
+// closed, and on startup after a crash.
+#define UFS_JOURNAL_MAGIC (0x4c4e524a)        // "JRNL"
+#define UFS_JOURNAL_DESC_MAGIC (0x4353444a)   // "JDSC"
+#define UFS_JOURNAL_COMMIT_MAGIC (0x4d4d434a) // "JCMM"
+
+#define JOURNAL_DESC_MAX_BLOCKS ((UFS_BLOCK_SIZE / sizeof(int)) - 3)
+
+typedef struct {
+    int magic; // UFS_JOURNAL_MAGIC
+    int journal_len; // in blocks, not counting this block
+    unsigned int checkpoint_seq; // last transaction already written in place
+} journal_super_t;
+
+typedef struct {
+    int magic; // UFS_JOURNAL_DESC_MAGIC
+    unsigned int seq; // transaction sequence number
+    int num_blocks; // number of block images following this block
+    int blocks[JOURNAL_DESC_MAX_BLOCKS]; // home block number of each image
+} journal_desc_t;
+
+typedef struct {
+    int magic; // UFS_JOURNAL_COMMIT_MAGIC
+    unsigned int seq; // matches the journal_desc_t
+    int num_blocks;
+    unsigned int checksum; // FNV-1a hash of the descriptor block and the images
+} journal_commit_t;
+
+// Copy-on-write overlay (see SnapshotDisk). Block 0 of an overlay file
+// holds an overlay_super_t naming the frozen base image, the table_len
+// blocks after it hold the remap table, an int per base block giving the
+// overlay block that replaces it (0 = read the base), then come
+// num_blocks data blocks handed out in order and a redo journal like an
+// image's. The file is created sparse and sized for the worst case, so
+// making a snapshot writes two blocks.
+#define UFS_OVERLAY_MAGIC (0x59414c56) // "VLAY"
+
+#define OVERLAY_BASE_MAX (UFS_BLOCK_SIZE - 8 * sizeof(int) - 3 * sizeof(long long))
+
+typedef struct {
+    int magic; // UFS_OVERLAY_MAGIC
+    int num_blocks; // blocks in the base image
+    int table_len; // in blocks, starting at block 1
+    int num_mapped; // data blocks in use, starting at block 1 + table_len
+    int journal_addr; // as in super_t: 1 + table_len + num_blocks
+    int journal_len;
+    // What the base looked like when the snapshot was taken: the size,
+    // modification time and inode number of its file (0 if it is not a
+    // single file) and an FNV-1a hash of its block 0, followed by the
+    // size, modification time and inode number of each file of a
+    // stripe: set. An overlay whose base no longer matches is not opened.
+    long long base_size;
+    long long base_mtime_sec;
+    unsigned long long base_ino;
+    int base_mtime_nsec;
+    unsigned int base_checksum;
+    char base[OVERLAY_BASE_MAX]; // Disk::open spec of the base image
+} overlay_super_t;
+
 #endif // __ufs_h__
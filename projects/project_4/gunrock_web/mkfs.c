@@ -8,7 +8,7 @@
 #include "ufs.h"
 
 void usage() {
-    fprintf(stderr, "usage: mkfs -f <image_file> [-d <num_data_blocks] [-i <num_inodes>]\n");
+    fprintf(stderr, "usage: mkfs -f <image_file> [-d <num_data_blocks] [-i <num_inodes>] [-j <num_journal_blocks>] [-V <inode_version>]\n");
     exit(1);
 }
 
@@ -17,9 +17,11 @@ int main(int argc, char *argv[]) {
     char *image_file = NULL;
     int num_inodes = 32;
     int num_data = 32;
+    int num_journal = 128;
+    int version = UFS_VERSION_DIRECT;
     int visual = 0;
 
-    while ((ch = getopt(argc, argv, "i:d:f:v")) != -1) {
+    while ((ch = getopt(argc, argv, "i:d:f:j:vV:")) != -1) {
 	switch (ch) {
 	case 'i':
 	    num_inodes = atoi(optarg);
@@ -30,9 +32,15 @@ int main(int argc, char *argv[]) {
 	case 'f':
 	    image_file = optarg;
 	    break;
+	case 'j':
+	    num_journal = atoi(optarg);
+	    break;
 	case 'v':
 	    visual = 1;
 	    break;
+	case 'V':
+	    version = atoi(optarg);
+	    break;
 	default:
 	    usage();
 	}
@@ -43,13 +51,6 @@ int main(int argc, char *argv[]) {
     if (image_file == NULL)
 	usage();
 
-    unsigned char *empty_buffer;
-    empty_buffer = calloc(UFS_BLOCK_SIZE, 1);
-    if (empty_buffer == NULL) {
-	perror("calloc");
-	exit(1);
-    }
-
     int fd = open(image_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
     if (fd < 0) {
 	perror("open");
@@ -58,9 +59,12 @@ int main(int argc, char *argv[]) {
 
     assert(num_inodes >= 32);
     assert(num_data >= 32);
+    assert(num_journal == 0 || num_journal >= 2);
+    assert(version >= UFS_VERSION_DIRECT && version <= UFS_VERSION_INLINE);
 
     // presumed: block 0 is the super block
     super_t s;
+    s.version = version;
 
     // totals
     s.num_inodes = num_inodes;
@@ -93,6 +97,16 @@ int main(int argc, char *argv[]) {
 
     int total_blocks = 1 + s.inode_bitmap_len + s.data_bitmap_len + s.inode_region_len + s.data_region_len;
 
+    // optional redo journal after the data region, with its own super
+    // block as the last block of the image (see ufs.h)
+    s.journal_addr = 0;
+    s.journal_len = 0;
+    if (num_journal > 0) {
+	s.journal_addr = total_blocks;
+	s.journal_len = num_journal;
+	total_blocks += num_journal + 1;
+    }
+
     // super block is the first block
     int rc = pwrite(fd, &s, sizeof(super_t), 0);
     if (rc != sizeof(super_t)) {
@@ -103,20 +117,23 @@ int main(int argc, char *argv[]) {
     printf("total blocks        %d\n", total_blocks);
     printf("  inodes            %d [size of each: %lu]\n", num_inodes, sizeof(inode_t));
     printf("  data blocks       %d\n", num_data);
+    if (version > UFS_VERSION_DIRECT)
+	printf("  inode version     %d\n", version);
     printf("layout details\n");
     printf("  inode bitmap address/len %d [%d]\n", s.inode_bitmap_addr, s.inode_bitmap_len);
     printf("  data bitmap address/len  %d [%d]\n", s.data_bitmap_addr, s.data_bitmap_len);
+    if (num_journal > 0)
+	printf("  journal address/len      %d [%d]\n", s.journal_addr, s.journal_len);
+
+    // first, zero out all the blocks; extending the file leaves the
+    // unused ones as holes, so big mostly-empty images stay sparse
+    rc = ftruncate(fd, (off_t) total_blocks * UFS_BLOCK_SIZE);
+    if (rc != 0) {
+	perror("ftruncate");
+	exit(1);
+    }
 
-    // first, zero out all the blocks
     int i;
-    for (i = 1; i < total_blocks; i++) {
-        rc = pwrite(fd, empty_buffer, UFS_BLOCK_SIZE, i * UFS_BLOCK_SIZE);
-        if (rc != UFS_BLOCK_SIZE) {
-            perror("write");
-            exit(1);
-        }
-    }
-    free(empty_buffer);
 
     //
     // need to allocate first inode in inode bitmap
@@ -181,8 +198,20 @@ int main(int argc, char *argv[]) {
     rc = pwrite(fd, &parent, UFS_BLOCK_SIZE, s.data_region_addr * UFS_BLOCK_SIZE);
     assert(rc == UFS_BLOCK_SIZE);
 
+    //
+    // empty journal: nothing has been committed or checkpointed yet
+    //
+    if (num_journal > 0) {
+	journal_super_t j;
+	memset(&j, 0, sizeof(j));
+	j.magic = UFS_JOURNAL_MAGIC;
+	j.journal_len = num_journal;
+	j.checkpoint_seq = 0;
+	rc = pwrite(fd, &j, sizeof(j), (off_t) (total_blocks - 1) * UFS_BLOCK_SIZE);
+	assert(rc == sizeof(j));
+    }
+
     if (visual) {
-	int i;
 	printf("\nVisualization of layout\n\n");
 	printf("S");
 	for (i = 0; i < s.inode_bitmap_len; i++)
@@ -193,6 +222,10 @@ int main(int argc, char *argv[]) {
 	    printf("I");
 	for (i = 0; i < s.data_region_len; i++)
 	    printf("D");
+	for (i = 0; i < num_journal; i++)
+	    printf("J");
+	if (num_journal > 0)
+	    printf("j");
 	printf("\n\n");
     }
 
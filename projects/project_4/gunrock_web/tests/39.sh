@@ -0,0 +1,16 @@
+#!/bin/bash
+set -e
+
+./mkfs -f test.img -d 64 -V 2 > /dev/null
+
+# 168894 bytes, 42 blocks: 28 direct and 14 behind the indirect block
+big=$(mktemp)
+trap 'rm -f $big' EXIT
+seq 1 30000 > $big
+
+./ds3touch test.img 0 big.txt
+./ds3cp test.img $big 1
+./ds3ls test.img /
+./ds3cat test.img 1 | sed '/^File data$/q'
+./ds3cat test.img 1 | sed '1,/^File data$/d' | cmp - $big
+./ds3bits test.img
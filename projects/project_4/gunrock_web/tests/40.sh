@@ -0,0 +1,24 @@
+#!/bin/bash
+set -e
+
+./mkfs -f test.img -V 3 > /dev/null
+
+small=$(mktemp)
+large=$(mktemp)
+trap 'rm -f $small $large' EXIT
+# INLINE_DATA_MAX is 120 bytes
+head -c 120 tests/6kwords.txt > $small
+head -c 121 tests/6kwords.txt > $large
+
+# Kept in the inode: no file blocks, no data block allocated
+./ds3touch test.img 0 small.txt
+./ds3cp test.img $small 1
+./ds3cat test.img 1
+echo
+./ds3bits test.img
+
+# One byte more moves it out to a data block
+./ds3cp test.img $large 1
+./ds3cat test.img 1
+echo
+./ds3bits test.img
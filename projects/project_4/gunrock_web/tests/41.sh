@@ -0,0 +1,27 @@
+#!/bin/bash
+set -e
+
+./mkfs -f test.img -i 256 > /dev/null
+
+# 128 entries fit in a directory block, so with . and .. the last two
+# files land in a second block
+for i in $(seq -w 1 128); do
+    ./ds3touch test.img 0 f$i
+done
+./ds3bits test.img
+
+# f128 moves into f050's slot and f127 is left alone in the second block
+# (ds3rm exits 1 once it has removed the entry)
+./ds3rm test.img 0 f050 || true
+./ds3ls test.img /
+./ds3bits test.img
+
+# f127 moves into f010's slot and the emptied second block is freed
+./ds3rm test.img 0 f010 || true
+./ds3ls test.img /
+./ds3bits test.img
+
+# The first block is full again, so a new entry takes a second block
+./ds3touch test.img 0 g001
+./ds3ls test.img / | tail -3
+./ds3bits test.img
@@ -0,0 +1,16 @@
+#!/bin/bash
+set -e
+
+# journal.img was left by a process that committed mkdir /journal and a
+# write to /journal/replayed.txt, then exited without checkpointing: the
+# records are only in its 16-block journal
+cp tests/disk_images/journal.img test.img
+
+# Only the root directory's data block is allocated at home
+od -An -tu1 -j $((2 * 4096)) -N 4 test.img
+
+# Opening the image replays the journal
+./ds3ls test.img /journal
+./ds3cat test.img 2
+./ds3bits test.img
+od -An -tu1 -j $((2 * 4096)) -N 4 test.img
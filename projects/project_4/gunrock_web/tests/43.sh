@@ -0,0 +1,18 @@
+#!/bin/bash
+set -e
+
+cp tests/disk_images/a.img test.img
+trap 'chmod u+w test.img; rm -f test.ovl' EXIT
+
+# ds3snap freezes test.img; everything after writes to the overlay
+./ds3snap test.img test.ovl
+./ds3mkdir cow:test.ovl 0 snap
+./ds3touch cow:test.ovl 0 snap.txt
+./ds3cp cow:test.ovl tests/6kwords.txt 5
+./ds3ls cow:test.ovl /
+./ds3bits cow:test.ovl
+./ds3cat cow:test.ovl 5 | sed '1,/^File data$/d' | cmp - tests/6kwords.txt
+
+# The base still reads, and is byte for byte, as it was
+./ds3ls test.img /
+cmp test.img tests/disk_images/a.img